@@ -12,6 +12,10 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The cache holds NBUF buffers once it has warmed up. If they
+// are all in use, it grows, and shrinks back as they are
+// released.
 
 
 #include "types.h"
@@ -25,7 +29,8 @@
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kcache *cache;
+  int nbuf;
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -33,23 +38,52 @@ struct {
   struct buf head;
 } bcache;
 
+static void
+bufctor(void *b)
+{
+  initsleeplock(&((struct buf*)b)->lock, "buffer");
+}
+
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kcachecreate("buf", sizeof(struct buf), bufctor);
 
-  // Create linked list of buffers
+  // Create empty linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+}
+
+// Return the least recently used (LRU) unused buffer, or 0.
+// Caller must hold bcache.lock.
+static struct buf*
+bunused(void)
+{
+  struct buf *b;
+
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev)
+    if(b->refcnt == 0)
+      return b;
+  return 0;
+}
+
+// Add a new buffer to the cache, or return 0 if out of memory.
+// Caller must hold bcache.lock.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  if((b = kcachealloc(bcache.cache)) == 0)
+    return 0;
+  b->refcnt = 0;
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -73,19 +107,20 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
-  }
-  panic("bget: no buffers");
+  // Recycle the least recently used (LRU) unused buffer
+  // if the cache is full, else add one.
+  b = 0;
+  if(bcache.nbuf >= NBUF)
+    b = bunused();
+  if(b == 0 && (b = bnew()) == 0 && (b = bunused()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,7 +147,8 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of the most-recently-used list, or free
+// it if the cache has grown past NBUF.
 void
 brelse(struct buf *b)
 {
@@ -127,6 +163,12 @@ brelse(struct buf *b)
     // no one is waiting for it.
     b->next->prev = b->prev;
     b->prev->next = b->next;
+    if(bcache.nbuf > NBUF){
+      bcache.nbuf--;
+      release(&bcache.lock);
+      kcachefree(bcache.cache, b);
+      return;
+    }
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
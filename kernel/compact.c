@@ -0,0 +1,131 @@
+// Compaction: making free 2MB blocks for superalloc() out of
+// fragmented memory. kisolate() picks a 2MB region that is
+// mostly free and keeps the allocator from handing out more of
+// it; compactregion() then moves every user page in the region
+// to a new physical page elsewhere, and the region's pages merge
+// into one free block as they are freed.
+//
+// A page can move if vmamovable() says so, and only while no
+// one can be using it: as in swap.c, the process that maps it
+// must be parked, RUNNABLE, and locked by us. The current
+// process's pages stay put, since its kernel code may be in the
+// middle of using them. Pages the kernel holds itself, such as
+// page-table pages, kernel stacks and slabs, never move either;
+// a region that has any doesn't come free, and kisolate()
+// leaves it alone after that.
+//
+// compact() runs when a superpage allocation fails, and
+// compactidle() when a hart has nothing else to do.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NCOMPACT     4    // regions compact() tries
+#define COMPACTSUPER 4    // compactidle() keeps this many superpages free...
+#define COMPACTFREE  1024 // ...if this many pages are free
+
+extern struct proc *procs;
+
+struct {
+  int busy;         // a compaction is under way
+  uint64 nmade;     // free 2MB blocks made, ever
+} compaction;
+
+// Move the pages of p that are in the 2MB region at region
+// elsewhere. Caller holds p->lock.
+static void
+compactproc(struct proc *p, uint64 region)
+{
+  uint64 va = 0, pa;
+  pte_t *pte;
+  char *mem;
+
+  while((pte = walknext(p->pagetable, &va)) != 0){
+    pa = PTE2PA(*pte);
+    if((*pte & PTE_SUPER) == 0 && pa - pa % SUPERPGSIZE == region &&
+       vmamovable(p, va, *pte)){
+      // kalloc() won't return a page in the region.
+      if((mem = kalloc()) == 0)
+        return;
+      memmove(mem, (char*)pa, PGSIZE);
+      *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+      p->tlbstale = (1L << NCPU) - 1;
+      kfree((void*)pa);
+    }
+    va += (*pte & PTE_SUPER) ? SUPERPGSIZE : PGSIZE;
+  }
+}
+
+// Try to empty the 2MB region that kisolate() returned.
+// Returns 1 if it is now a free block, 0 if not.
+static int
+compactregion(uint64 region)
+{
+  struct proc *p;
+
+  push_off();  // see procs in proc.c
+  for(p = procs; p; p = p->next){
+    acquire(&p->lock);
+    if(p != myproc() && p->pagetable && p->parked && p->state == RUNNABLE)
+      compactproc(p, region);
+    release(&p->lock);
+  }
+  pop_off();
+  if(!kunisolate())
+    return 0;
+  compaction.nmade++;
+  return 1;
+}
+
+// Try to make a free 2MB block, for when superalloc() fails.
+// The caller must hold no spinlocks, since other processes'
+// locks are taken. Returns 1 if a block was made, else 0.
+int
+compact(void)
+{
+  uint64 region;
+  int i, ok = 0;
+
+  if(__atomic_exchange_n(&compaction.busy, 1, __ATOMIC_ACQUIRE))
+    return 0;
+  for(i = 0; i < NCOMPACT && !ok; i++){
+    if((region = kisolate(i == 0)) == 0)
+      break;
+    ok = compactregion(region);
+  }
+  __atomic_store_n(&compaction.busy, 0, __ATOMIC_RELEASE);
+  return ok;
+}
+
+// Make a free 2MB block if there are few, for a hart with
+// nothing else to do. Called by scheduler() with no locks held.
+// Returns 0 if there was nothing to do, so the hart can wait for
+// an interrupt instead.
+int
+compactidle(void)
+{
+  uint64 region;
+
+  if(kfreesupers() >= COMPACTSUPER || kfreepages() < COMPACTFREE)
+    return 0;
+  if(__atomic_exchange_n(&compaction.busy, 1, __ATOMIC_ACQUIRE))
+    return 0;
+  // regions that failed before stay failed until compact()
+  // retries them, so this soon runs out of things to do.
+  if((region = kisolate(0)) != 0)
+    compactregion(region);
+  __atomic_store_n(&compaction.busy, 0, __ATOMIC_RELEASE);
+  return region != 0;
+}
+
+// Return the number of free 2MB blocks compaction has made.
+uint64
+compacted(void)
+{
+  return compaction.nmade;
+}
@@ -84,6 +84,9 @@ consoleread(int user_dst, uint64 dst, int n)
   char cbuf;
 
   target = n;
+  // either_copyout() below runs under cons.lock.
+  if(user_dst && n > 0 && uvmprefault(myproc()->pagetable, dst, n, 1) < 0)
+    return -1;
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
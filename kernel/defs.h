@@ -6,12 +6,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kcache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct shm;
 
 // bio.c
 void            binit(void);
@@ -28,6 +31,12 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             kexec(struct proc*, char*, char**);
+
+// fdt.c
+extern uint64   fdtaddr;
+extern uint64   phystop;
+void            fdtinit(void);
 
 // file.c
 struct file*    filealloc(void);
@@ -69,6 +78,42 @@ void            kfree(void *);
 void            kinit(void);
 void*           superalloc(void);
 void            superfree(void *);
+void            krefinc(void *);
+int             krefcnt(void *);
+void*           kalloc_zeroed(void);
+void*           superalloc_zeroed(void);
+int             kzeroidle(void);
+int             kpromote(void *);
+void            kdemote(void *);
+uint64          kfreepages(void);
+uint64          kfreesupers(void);
+uint64          ktotalpages(void);
+void            kmarkksm(void *);
+int             kisksm(void *);
+int             kgetksm(void *);
+int             kclaimksm(void *);
+uint64          kisolate(int);
+int             kunisolate(void);
+
+// ksm.c
+void            ksminit(void);
+void            ksmscan(void);
+void            ksmforget(struct proc*);
+void            ksmbreak(uint64);
+void            ksmstat(uint64*, uint64*);
+
+// compact.c
+int             compact(void);
+int             compactidle(void);
+uint64          compacted(void);
+
+// slab.c
+struct kcache*  kcachecreate(char*, uint, void (*)(void*));
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+void            kmallocinit(void);
+void*           kmalloc(uint);
+void            kmfree(void*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -77,6 +122,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -91,8 +137,10 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             vfork(void);
+void            vforkrelease(struct proc*);
+int             spawn(char*, char**, int*);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -106,12 +154,14 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            swapdinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             procinfo(uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -156,6 +206,9 @@ extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+#ifdef LAB_PGTBL
+extern struct vdata *vdata;
+#endif
 void            usertrapret(void);
 
 // uart.c
@@ -176,13 +229,28 @@ uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
+pte_t *         walknext(pagetable_t, uint64*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             cowfault(pagetable_t, uint64);
+uint64          vmfault(pagetable_t, uint64, int);
+int             uvmprefault(pagetable_t, uint64, uint64, int);
+int             uvmpromote(pagetable_t, uint64);
+int             uvmdemote(pagetable_t, uint64);
+uint64          uvmsatp(struct proc*);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+void            uvmflush(pagetable_t, uint64, uint64);
+void            uvmresident(pagetable_t, long);
+int             uvmtopmap(pagetable_t, uint64, uint64);
+void            uvmtopunmap(pagetable_t);
+void            uvmstat(pagetable_t, uint64*, uint64*, uint64*);
+int             uvmpgbits(pagetable_t, uint64, uint64, uint64, int);
 #if defined(LAB_PGTBL) || defined(SOL_MMAP)
 void            vmprint(pagetable_t);
 #endif
@@ -190,6 +258,39 @@ void            vmprint(pagetable_t);
 pte_t*          pgpte(pagetable_t, uint64);
 #endif
 
+// vma.c
+void            vmainit(void);
+void            vmafileio(struct inode*, uint64, uint64, uint64, int);
+struct vma*     vmalookup(struct proc*, uint64);
+int             vmaoverlap(struct proc*, uint64, uint64);
+uint64          vmapage(struct vma*, uint64);
+int             vmadup(struct proc*, struct proc*);
+void            vmarelease(struct vma*, int);
+int             vmamovable(struct proc*, uint64, pte_t);
+uint64          vmammap(struct proc*, uint64, int, int, struct file*, uint64);
+int             vmaunmap(struct proc*, uint64, uint64);
+void            vmaexit(struct proc*);
+uint64          vmashmat(struct proc*, int, uint64);
+int             vmashmdt(struct proc*, int);
+
+// shm.c
+void            shminit(void);
+int             shmcreate(struct proc*, uint64);
+struct shm*     shmget(int, uint64*);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+int             shmis(struct shm*, int);
+uint64          shmpage(struct shm*, uint64);
+void            shmexit(struct proc*);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+void            swapfree(int);
+int             swapreclaim(void);
+void            swapforget(struct proc*);
+void            swapd(void);
+int             swapin(pagetable_t, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -7,8 +7,6 @@
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -21,15 +19,27 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return kexec(myproc(), path, argv);
+}
+
+// Replace p's user image with the program path. p is either the
+// caller, or a new child of the caller's that spawn() is setting
+// up and that hasn't run yet.
+int
+kexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nvma = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct trapframe *tf = 0;
+
+  memset(vma, 0, sizeof(vma));
 
   begin_op();
 
@@ -46,10 +56,20 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
+  // a vfork() child is on its parent's trapframe page; the new
+  // page table gets the child's own.
+  if(p->vforkparent){
+    tf = p->trapframe;
+    memmove(p->vforkframe, tf, sizeof(*tf));
+    p->trapframe = p->vforkframe;
+  }
+
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where each segment of the program comes from.
+  // Nothing is read yet: vmfault() reads each page from the
+  // file the first time the program touches it.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,18 +81,26 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= MMAPTOP)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(nvma >= NVMA)
       goto bad;
+    v = &vma[nvma++];
+    v->type = VMA_EXEC;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->perm = flags2perm(ph.flags) | PTE_R | PTE_U;
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate some pages at the next page boundary.
@@ -121,46 +149,36 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  if(p->vforkparent)
+    vforkrelease(p);  // the old image is the parent's
+  else
+    vmaexit(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asidgen = 0;  // the old ASID's TLB entries belong to the old page table
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  if(oldpagetable)
+    proc_freepagetable(oldpagetable, oldsz);
+  memmove(p->vma, vma, sizeof(vma));
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  if(tf)
+    p->trapframe = tf;
   if(ip){
+    // exec still holds ip, so these puts can't be the last.
+    vmarelease(vma, nvma);
     iunlockput(ip);
     end_op();
+  } else {
+    begin_op();
+    vmarelease(vma, nvma);
+    end_op();
   }
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
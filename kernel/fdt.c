@@ -0,0 +1,139 @@
+// Finding out how much RAM there is from the flattened device
+// tree (FDT) that qemu puts in memory and passes to each hart
+// at boot. Only the memory node matters: its reg property says
+// where RAM starts and how big it is.
+//
+// The tree is a header, then a block of structure tokens, all
+// big-endian 32-bit words, then a block of property names.
+// A node is FDT_BEGIN_NODE, its NUL-terminated name, padded to
+// a word, its properties and child nodes, then FDT_END_NODE.
+// A property is FDT_PROP, its length, the offset of its name,
+// and its value, padded to a word.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+struct fdthdr {
+  uint magic;
+  uint totalsize;
+  uint off_dt_struct;
+  uint off_dt_strings;
+  uint off_mem_rsvmap;
+  uint version;
+  uint last_comp_version;
+  uint boot_cpuid_phys;
+  uint size_dt_strings;
+  uint size_dt_struct;
+};
+
+uint64 fdtaddr;   // where start() found the tree
+uint64 phystop;   // end of RAM, set by fdtinit()
+
+static uint
+be32(uint *p)
+{
+  uchar *b = (uchar*)p;
+
+  return ((uint)b[0] << 24) | ((uint)b[1] << 16) | ((uint)b[2] << 8) | b[3];
+}
+
+// Read a number n cells long from p.
+static uint64
+cells(uint *p, int n)
+{
+  uint64 x = 0;
+
+  while(n-- > 0)
+    x = (x << 32) | be32(p++);
+  return x;
+}
+
+// Does node name s start with the word "memory"?
+static int
+ismemory(char *s)
+{
+  return strncmp(s, "memory", 6) == 0 && (s[6] == '\0' || s[6] == '@');
+}
+
+// Return the end of the RAM that starts at KERNBASE, according
+// to the device tree at fdt, or 0 if the tree doesn't say.
+static uint64
+fdtmemtop(uint64 fdt)
+{
+  struct fdthdr *h = (struct fdthdr *)fdt;
+  uint *p, *end, len;
+  char *strs, *name;
+  int depth = 0, acells = 2, scells = 2, inmem = 0;
+  uint64 base, size, top = 0;
+
+  if(fdt == 0 || be32(&h->magic) != FDT_MAGIC)
+    return 0;
+  p = (uint*)(fdt + be32(&h->off_dt_struct));
+  end = (uint*)((char*)p + be32(&h->size_dt_struct));
+  strs = (char*)(fdt + be32(&h->off_dt_strings));
+
+  while(p < end){
+    switch(be32(p++)){
+    case FDT_BEGIN_NODE:
+      name = (char*)p;
+      p += (strlen(name) + 4) / 4;
+      depth++;
+      // the root is at depth 1, so memory at depth 2.
+      inmem = depth == 2 && ismemory(name);
+      break;
+    case FDT_END_NODE:
+      depth--;
+      inmem = 0;
+      break;
+    case FDT_PROP:
+      len = be32(p++);
+      name = strs + be32(p++);
+      if(depth == 1 && strncmp(name, "#address-cells", 15) == 0)
+        acells = be32(p);
+      else if(depth == 1 && strncmp(name, "#size-cells", 12) == 0)
+        scells = be32(p);
+      else if(inmem && strncmp(name, "reg", 4) == 0){
+        for(uint *r = p; r + acells + scells <= p + len/4; r += acells + scells){
+          base = cells(r, acells);
+          size = cells(r + acells, scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            top = base + size;
+        }
+      }
+      p += (len + 3) / 4;
+      break;
+    case FDT_NOP:
+      break;
+    default:
+      return top;
+    }
+  }
+  return top;
+}
+
+// Set phystop from the device tree. Called by main() before
+// kinit(), since the tree is in RAM that kinit() will hand out.
+void
+fdtinit(void)
+{
+  uint64 top = fdtmemtop(fdtaddr);
+
+  if(top == 0){
+    printf("fdtinit: no memory in device tree, assuming %dMB\n",
+           (int)((PHYSDEFAULT - KERNBASE) >> 20));
+    top = PHYSDEFAULT;
+  }
+  if(top > PHYSMAX)
+    top = PHYSMAX;
+  phystop = PGROUNDDOWN(top);
+}
@@ -15,32 +15,29 @@
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;  // protects every file's ref
+  struct kcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kcachecreate("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kcachealloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +66,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kcachefree(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -107,6 +103,7 @@ int
 fileread(struct file *f, uint64 addr, int n)
 {
   int r = 0;
+  uint off;
 
   if(f->readable == 0)
     return -1;
@@ -118,10 +115,25 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // readi() copies out holding the inode and a buffer lock,
+    // and a fault there reading in a page of a mapped file or
+    // program could want them too. So fault in the part of the
+    // buffer the file can fill first, and read no more than that.
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if(n < 0 || f->off >= f->ip->size)
+      n = 0;
+    else if(n > f->ip->size - f->off)
+      n = f->ip->size - f->off;
+    iunlock(f->ip);
+    if(n > 0 && uvmprefault(myproc()->pagetable, addr, n, 1) < 0)
+      return -1;
+    ilock(f->ip);
+    off = f->off;
+    if((r = readi(f->ip, 1, addr, off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+    if(r > 0)
+      vmafileio(f->ip, off, addr, r, 0);
   } else {
     panic("fileread");
   }
@@ -154,17 +166,25 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    uint off;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      // as in fileread(), nothing may fault in while writei()
+      // holds its locks.
+      if(uvmprefault(myproc()->pagetable, addr + i, n1, 0) < 0)
+        break;
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      off = f->off;
+      if ((r = writei(f->ip, 1, addr + i, off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
+      if(r > 0)
+        vmafileio(f->ip, off, addr + i, r, 1);
 
       if(r != n1){
         // error from writei
@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages
+// and 2MB superpages.
 
 #include "types.h"
 #include "param.h"
@@ -9,71 +10,660 @@
 #include "riscv.h"
 #include "defs.h"
 
-#define NUM_SUPERPAGES 10  // 定义超级页的数量(handful)
-static char *superpages[NUM_SUPERPAGES]; // 超级页指针数组
-static int superpage_used[NUM_SUPERPAGES];  // 标记超级页是否已被使用
-
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// All of physical memory between pages[] and phystop is managed
+// by a binary buddy allocator. A block of order k is 2^k pages,
+// aligned to its own size; order MAXORDER is one superpage.
+// Freeing a block merges it with its buddy whenever the buddy
+// is also free, so superpages reappear as 4KB pages are freed.
+#define MAXORDER 9
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDX2PA(i)  (KERNBASE + (uint64)(i) * PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;  // only maintained on buddy free lists
+};
+
+// Per-frame state, indexed by PA2IDX. kinit() puts pages[]
+// just after the kernel, sized for RAM up to phystop.
+struct page {
+  int ref;     // number of references to an allocated block
+  char order;  // order of the block this page heads
+  char free;   // heads a block on a buddy free list
+  char stuck;  // compaction of the 2MB region this page heads failed
+  char ksm;    // a page that ksm.c merges identical pages into
 };
 
+static struct page *pages;
+static uint64 npages;
+
+// Free pages live in the buddy allocator plus a small cache
+// of 4KB pages per hart. kalloc() and kfree() normally touch
+// only the calling hart's cache, moving KBATCH pages at a time
+// to or from the buddy allocator, so harts rarely contend for
+// kmem.lock.
+#define KBATCH 32        // pages moved per refill or drain
+#define KHIGH  (2*KBATCH) // drain a hart's cache above this
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  uint64 nfree;  // pages on the free lists
+  uint64 nsuper; // of which whole superpages
+  uint64 ntotal; // pages kinit() freed
+  uint64 isolated; // 2MB region being compacted, or 0
 } kmem;
 
+struct kcpu {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcpu[NCPU];
+
+// Pools of pages that idle harts have already zeroed, so that
+// kalloc_zeroed() and superalloc_zeroed() needn't memset on the
+// allocating path. A pooled page is zero except for its first
+// word, the list link. A superpage being zeroed is parked in
+// kzero.filling while idle harts claim it 4KB at a time.
+#define KZPAGES  256  // zeroed 4KB pages to keep
+#define KZSUPER  2    // zeroed superpages to keep
+
+struct {
+  struct spinlock lock;
+  struct run *pages;
+  int npages;
+  struct run *supers;
+  int nsupers;
+  char *filling;      // superpage being zeroed
+  int fillnext;       // next 4KB chunk of it to hand out
+  int filldone;       // chunks zeroed so far
+} kzero;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
-
-  // 预留一块内存作为超级页
-  char *superpage_area = (char *)PGROUNDUP((uint64)end);
-
-  for (int i = 0; i < NUM_SUPERPAGES; i++) {
-    superpages[i] = superpage_area + i * SUPERPGSIZE;  // 为每个超级页分配 2MB 对齐的地址
-    superpage_used[i] = 0;  // 标记为未使用
-  }
-  
-  // 调用 freerange() 继续初始化普通页（4KB 页）
-  freerange(superpage_area + NUM_SUPERPAGES * SUPERPGSIZE, (void*)PHYSTOP);
+  initlock(&kzero.lock, "kzero");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kcpu");
+  pages = (struct page*)PGROUNDUP((uint64)end);
+  npages = (phystop - KERNBASE) / PGSIZE;
+  memset(pages, 0, npages * sizeof(struct page));
+  freerange(pages + npages, (void*)phystop);
+  kmem.ntotal = kmem.nfree;
 }
 
+static void buddy_free(void *pa, int order);
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&kmem.lock);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    buddy_free(p, 0);
+  }
+  release(&kmem.lock);
 }
 
-// Free the page of physical memory pointed at by pa,
+static void
+buddy_push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nfree += 1L << order;
+  if(order == MAXORDER)
+    kmem.nsuper++;
+  pages[PA2IDX(r)].order = order;
+  pages[PA2IDX(r)].free = 1;
+}
+
+static void
+buddy_remove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree -= 1L << order;
+  if(order == MAXORDER)
+    kmem.nsuper--;
+  pages[PA2IDX(r)].free = 0;
+}
+
+// Is pa in the region that compaction is emptying?
+static int
+isolated(void *pa)
+{
+  uint64 region = __atomic_load_n(&kmem.isolated, __ATOMIC_RELAXED);
+
+  return region && (uint64)pa - (uint64)pa % SUPERPGSIZE == region;
+}
+
+// Allocate a block of 2^order pages, outside any region that
+// compaction is emptying.
+// Caller must hold kmem.lock.
+static void *
+buddy_alloc(int order)
+{
+  struct run *r = 0;
+  int o;
+
+  for(o = order; o <= MAXORDER; o++){
+    for(r = kmem.freelist[o]; r && isolated(r); r = r->next)
+      ;
+    if(r)
+      break;
+  }
+  if(o > MAXORDER)
+    return 0;
+
+  buddy_remove(r, o);
+
+  // split off upper halves until the block is the right size.
+  while(o > order){
+    o--;
+    buddy_push((struct run*)((char*)r + ((uint64)PGSIZE << o)), o);
+  }
+  pages[PA2IDX(r)].order = order;
+  return (void*)r;
+}
+
+// Free a block of 2^order pages, merging it with its
+// buddy for as long as the buddy is free too.
+// Caller must hold kmem.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 idx, bidx;
+
+  idx = PA2IDX(pa);
+  if(pages[idx].free)
+    panic("buddy_free: double free");
+
+  for(; order < MAXORDER; order++){
+    bidx = idx ^ (1L << order);
+    if(bidx >= npages || !pages[bidx].free || pages[bidx].order != order)
+      break;
+    buddy_remove((struct run*)IDX2PA(bidx), order);
+    if(bidx < idx)
+      idx = bidx;
+  }
+  buddy_push((struct run*)IDX2PA(idx), order);
+}
+
+// Detach up to n pages from the front of *list.
+// Returns the detached chain; the caller holds
+// whatever lock protects *list.
+static struct run *
+takepages(struct run **list, int n, int *got)
+{
+  struct run *head, *r;
+  int i;
+
+  head = r = *list;
+  if(r == 0){
+    *got = 0;
+    return 0;
+  }
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *got = i;
+  return head;
+}
+
+// Find the last page of a chain.
+static struct run *
+lastpage(struct run *r)
+{
+  while(r->next)
+    r = r->next;
+  return r;
+}
+
+// Return a chain of cached 4KB pages to the buddy allocator.
+static void
+kdrainpages(struct run *r)
+{
+  struct run *next;
+
+  acquire(&kmem.lock);
+  for(; r; r = next){
+    next = r->next;
+    buddy_free(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Give every hart's cached pages back to the buddy allocator,
+// so that they can merge into larger blocks again.
+static void
+kdrain(void)
+{
+  struct run *r;
+  int n;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kcpu[i].lock);
+    r = takepages(&kcpu[i].freelist, kcpu[i].nfree, &n);
+    kcpu[i].nfree = 0;
+    release(&kcpu[i].lock);
+    kdrainpages(r);
+  }
+}
+
+// Drop one reference to the block at pa, which must be
+// the start of an allocated block of the given order.
+// Returns the number of references left.
+static int
+krefdec(void *pa, int order)
+{
+  struct page *pg = &pages[PA2IDX(pa)];
+  int ref;
+
+  if(pg->order != order)
+    panic("krefdec: wrong order");
+  ref = __sync_sub_and_fetch(&pg->ref, 1);
+  if(ref < 0)
+    panic("krefdec");
+  return ref;
+}
+
+// Add a reference to the page or superpage at pa, so that
+// kfree() or superfree() won't release it until every
+// holder has dropped its reference.
+void
+krefinc(void *pa)
+{
+  if((char*)pa < end || (uint64)pa >= phystop)
+    panic("krefinc");
+  __sync_fetch_and_add(&pages[PA2IDX(pa)].ref, 1);
+}
+
+// Number of references to the page or superpage at pa.
+int
+krefcnt(void *pa)
+{
+  if((char*)pa < end || (uint64)pa >= phystop)
+    panic("krefcnt");
+  return __atomic_load_n(&pages[PA2IDX(pa)].ref, __ATOMIC_SEQ_CST);
+}
+
+// Mark the page at pa, held only by the caller, as one that
+// ksm.c merges identical pages into, so that kgetksm() may hand
+// out references to it from now on.
+void
+kmarkksm(void *pa)
+{
+  __atomic_store_n(&pages[PA2IDX(pa)].ksm, 1, __ATOMIC_SEQ_CST);
+}
+
+// Is the page at pa one that kmarkksm() marked?
+int
+kisksm(void *pa)
+{
+  if((char*)pa < end || (uint64)pa >= phystop)
+    panic("kisksm");
+  return __atomic_load_n(&pages[PA2IDX(pa)].ksm, __ATOMIC_SEQ_CST);
+}
+
+// Add a reference to the page at pa if it is still allocated
+// and still marked by kmarkksm(). ksm.c keeps no reference of
+// its own to the pages it marks, so they may have been freed
+// and reused. Returns 1 if the reference was taken.
+int
+kgetksm(void *pa)
+{
+  struct page *pg = &pages[PA2IDX(pa)];
+  int ref;
+
+  do {
+    ref = __atomic_load_n(&pg->ref, __ATOMIC_SEQ_CST);
+    if(ref == 0)
+      return 0;
+  } while(!__atomic_compare_exchange_n(&pg->ref, &ref, ref + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  // kclaimksm() clears ksm before looking at ref, so one of
+  // us sees what the other did.
+  if(__atomic_load_n(&pg->ksm, __ATOMIC_SEQ_CST))
+    return 1;
+  if(pg->order == MAXORDER)
+    superfree(pa);
+  else
+    kfree(pa);
+  return 0;
+}
+
+// The caller, holding the only reference to the page at pa,
+// wants to write it in place. Stop it being a merged page.
+// Returns 0 if kgetksm() took another reference meanwhile, in
+// which case the caller must copy the page after all.
+int
+kclaimksm(void *pa)
+{
+  struct page *pg = &pages[PA2IDX(pa)];
+
+  __atomic_store_n(&pg->ksm, 0, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&pg->ref, __ATOMIC_SEQ_CST) == 1;
+}
+
+// Turn the 512 contiguous 4KB pages starting at the 2MB-aligned
+// pa, each allocated and held by exactly one reference, into
+// one superpage block that superfree() will release as a whole.
+// Returns -1, changing nothing, if some page doesn't qualify.
+int
+kpromote(void *pa)
+{
+  struct page *pg;
+  int i;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= phystop)
+    panic("kpromote");
+  pg = &pages[PA2IDX(pa)];
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++)
+    if(pg[i].ref != 1 || pg[i].order != 0 || pg[i].free)
+      return -1;
+  for(i = 1; i < SUPERPGSIZE/PGSIZE; i++)
+    pg[i].ref = 0;
+  pg[0].order = MAXORDER;
+  return 0;
+}
+
+// The reverse of kpromote(): turn the superpage block at pa,
+// held by exactly one reference, into 512 separate 4KB pages,
+// each with one reference, that kfree() releases one by one.
+void
+kdemote(void *pa)
+{
+  struct page *pg;
+  int i;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= phystop)
+    panic("kdemote");
+  pg = &pages[PA2IDX(pa)];
+  if(pg[0].order != MAXORDER || pg[0].ref != 1)
+    panic("kdemote: not a private superpage");
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    pg[i].order = 0;
+    pg[i].ref = 1;
+  }
+}
+
+// Drop a reference to the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc(), and free it once no references remain.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch = 0;
+  struct kcpu *kc;
+  int n;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= phystop)
     panic("kfree");
+  if(krefdec(pa, 0) > 0)
+    return;
 
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
+  if(isolated(pa)){
+    // straight back to the buddy lists, to merge.
+    acquire(&kmem.lock);
+    buddy_free(pa, 0);
+    release(&kmem.lock);
+    return;
+  }
+
   r = (struct run*)pa;
 
+  push_off();
+  kc = &kcpu[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > KHIGH){
+    batch = takepages(&kc->freelist, KBATCH, &n);
+    kc->nfree -= n;
+  }
+  release(&kc->lock);
+
+  // hand the surplus back to the buddy allocator.
+  if(batch)
+    kdrainpages(batch);
+  pop_off();
+}
+
+// Take a batch of pages for hart id: first from the buddy
+// allocator, then by stealing half of another hart's cache.
+// Returns the chain; *got says how long it is.
+// Must be called with interrupts off and no kcpu lock held.
+static struct run *
+krefill(int id, int *got)
+{
+  struct run *batch = 0, *r;
+  struct kcpu *kc;
+
+  *got = 0;
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  while(*got < KBATCH && (r = buddy_alloc(0)) != 0){
+    r->next = batch;
+    batch = r;
+    (*got)++;
+  }
   release(&kmem.lock);
+  if(batch)
+    return batch;
+
+  for(int i = 1; i < NCPU; i++){
+    kc = &kcpu[(id + i) % NCPU];
+    acquire(&kc->lock);
+    batch = takepages(&kc->freelist, (kc->nfree + 1) / 2, got);
+    kc->nfree -= *got;
+    release(&kc->lock);
+    if(batch)
+      return batch;
+  }
+  return 0;
+}
+
+// Take a page from the zeroed pool, or return 0.
+static struct run *
+kzerotake(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.pages) != 0){
+    kzero.pages = r->next;
+    kzero.npages--;
+  }
+  release(&kzero.lock);
+  return r;
+}
+
+// Take a superpage from the zeroed pool, or return 0.
+static void *
+ksupertake(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.supers) != 0){
+    kzero.supers = r->next;
+    kzero.nsupers--;
+  }
+  release(&kzero.lock);
+  return r;
+}
+
+static struct run *kgetpage(void);
+
+// Zero one 4KB chunk of the superpage being filled, and move
+// the superpage to the pool once every chunk is done.
+static void
+kzerochunk(char *sp, int chunk)
+{
+  struct run *r;
+
+  memset(sp + (uint64)chunk * PGSIZE, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(++kzero.filldone == SUPERPGSIZE/PGSIZE){
+    r = (struct run*)kzero.filling;
+    r->next = kzero.supers;
+    kzero.supers = r;
+    kzero.nsupers++;
+    kzero.filling = 0;
+  }
+  release(&kzero.lock);
+}
+
+// Do one page's worth of zeroing for the pools, for a hart
+// with nothing else to do. Called by scheduler() with no locks
+// held. Returns 0 if there is nothing to zero (the pools are
+// full, or memory is too short to fill them), so the hart can
+// wait for an interrupt instead.
+int
+kzeroidle(void)
+{
+  struct run *r;
+  char *sp;
+  int chunk = -1, want = 0;
+
+  acquire(&kzero.lock);
+  sp = kzero.filling;
+  if(sp && kzero.fillnext < SUPERPGSIZE/PGSIZE)
+    chunk = kzero.fillnext++;
+  else if(kzero.npages < KZPAGES)
+    want = 1;
+  else if(sp == 0 && kzero.nsupers < KZSUPER)
+    want = 2;
+  release(&kzero.lock);
+
+  if(chunk >= 0){
+    kzerochunk(sp, chunk);
+    return 1;
+  }
+
+  if(want == 1){
+    if((r = kgetpage()) == 0)
+      return 0;
+    memset(r, 0, PGSIZE);
+    acquire(&kzero.lock);
+    r->next = kzero.pages;
+    kzero.pages = r;
+    kzero.npages++;
+    release(&kzero.lock);
+    return 1;
+  }
+
+  if(want == 2){
+    // only an already-free 2MB block; don't break up
+    // the hart caches just to keep the pool full.
+    acquire(&kmem.lock);
+    sp = buddy_alloc(MAXORDER);
+    release(&kmem.lock);
+    if(sp == 0)
+      return 0;
+    acquire(&kzero.lock);
+    if(kzero.filling){
+      // another hart started one first.
+      release(&kzero.lock);
+      acquire(&kmem.lock);
+      buddy_free(sp, MAXORDER);
+      release(&kmem.lock);
+      return 1;
+    }
+    kzero.filling = sp;
+    kzero.fillnext = 1;
+    kzero.filldone = 0;
+    release(&kzero.lock);
+    kzerochunk(sp, 0);
+    return 1;
+  }
+  return 0;
+}
+
+// Give the zeroed pools back to the buddy allocator,
+// for when memory runs short. Returns 1 if anything was freed.
+static int
+kzerodrain(void)
+{
+  struct run *pl, *sl, *r;
+
+  acquire(&kzero.lock);
+  pl = kzero.pages;
+  sl = kzero.supers;
+  kzero.pages = kzero.supers = 0;
+  kzero.npages = kzero.nsupers = 0;
+  release(&kzero.lock);
+
+  if(pl == 0 && sl == 0)
+    return 0;
+  acquire(&kmem.lock);
+  for(; pl; pl = r){
+    r = pl->next;
+    buddy_free(pl, 0);
+  }
+  for(; sl; sl = r){
+    r = sl->next;
+    buddy_free(sl, MAXORDER);
+  }
+  release(&kmem.lock);
+  return 1;
+}
+
+// Take one free 4KB page from this hart's cache, refilling
+// the cache if it is empty. The page's contents are whatever
+// kfree() left there. Returns 0 if no page is free.
+static struct run *
+kgetpage(void)
+{
+  struct run *r, *batch;
+  struct kcpu *kc;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  kc = &kcpu[id];
+
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+
+  if(r == 0 && (batch = krefill(id, &n)) != 0){
+    // keep the first page, cache the rest.
+    r = batch;
+    if(n > 1){
+      acquire(&kc->lock);
+      lastpage(batch)->next = kc->freelist;
+      kc->freelist = batch->next;
+      kc->nfree += n - 1;
+      release(&kc->lock);
+    }
+  }
+  pop_off();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -84,35 +674,204 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if((r = kgetpage()) == 0 && (r = kzerotake()) == 0 &&
+     (!kzerodrain() || (r = kgetpage()) == 0))
+    return 0;
+  memset((char*)r, 5, PGSIZE); // fill with junk
+  __atomic_store_n(&pages[PA2IDX(r)].ksm, 0, __ATOMIC_SEQ_CST);
+  pages[PA2IDX(r)].ref = 1;
+  return (void*)r;
+}
+
+// Allocate one 4096-byte page whose contents are all zero,
+// from the pool that idle harts keep zeroed when possible.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if((r = kzerotake()) == 0){
+    if((r = kgetpage()) == 0 && (!kzerodrain() || (r = kgetpage()) == 0))
+      return 0;
+    memset((char*)r, 0, PGSIZE);
+  } else
+    r->next = 0;  // the only non-zero word of a pooled page
+  __atomic_store_n(&pages[PA2IDX(r)].ksm, 0, __ATOMIC_SEQ_CST);
+  pages[PA2IDX(r)].ref = 1;
   return (void*)r;
 }
 
-void *superalloc(void) 
+// Take a dirty 2MB block from the buddy allocator, pulling
+// the per-hart caches back into the buddy lists if need be.
+static void *
+kgetsuper(void)
 {
-  for (int i = 0; i < NUM_SUPERPAGES; i++) {
-      if (!superpage_used[i]) {  // 找到一个未使用的超级页
-          superpage_used[i] = 1;  // 标记为已使用
-          return (void *)superpages[i];
-      }
+  void *pa;
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(MAXORDER);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    kdrain();
+    acquire(&kmem.lock);
+    pa = buddy_alloc(MAXORDER);
+    release(&kmem.lock);
   }
-  return 0;  // 如果没有可用的超级页，则返回 NULL
+  return pa;
+}
+
+// Allocate one 2MB superpage, aligned to 2MB.
+// Returns 0 if no free 2MB block exists even after
+// pulling the per-hart caches back into the buddy lists.
+void *
+superalloc(void)
+{
+  void *pa;
+
+  if((pa = kgetsuper()) == 0 && (pa = ksupertake()) == 0 &&
+     (!kzerodrain() || (pa = kgetsuper()) == 0))
+    return 0;
+  pages[PA2IDX(pa)].ref = 1;
+  return pa;
+}
+
+// Allocate one 2MB superpage whose contents are all zero.
+void *
+superalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = ksupertake()) == 0){
+    if((pa = kgetsuper()) == 0 && (!kzerodrain() || (pa = kgetsuper()) == 0))
+      return 0;
+    memset(pa, 0, SUPERPGSIZE);
+  } else
+    ((struct run*)pa)->next = 0;
+  pages[PA2IDX(pa)].ref = 1;
+  return pa;
+}
+
+// Drop a reference to a superpage returned by superalloc(),
+// and free it once no references remain.
+void
+superfree(void *pa)
+{
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= phystop)
+    panic("superfree");
+  if(krefdec(pa, MAXORDER) > 0)
+    return;
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, SUPERPGSIZE);
+
+  acquire(&kmem.lock);
+  buddy_free(pa, MAXORDER);
+  release(&kmem.lock);
 }
 
-void superfree(void *ptr) 
+// Compaction (compact.c) empties a 2MB region of memory by
+// moving the user pages in it elsewhere. kisolate() picks the
+// region: the one with the most free pages, at least
+// KCOMPACTMIN, that isn't free already and hasn't failed to
+// come free before. Until kunisolate(), the buddy allocator
+// hands out nothing in it, and kfree() puts pages in it back
+// on the buddy lists, where they merge, rather than in a hart
+// cache. If every region has failed and retry is set, their
+// failures are forgotten and they are tried again.
+// Returns the region's address, or 0 if there is none.
+#define KCOMPACTMIN 128
+
+uint64
+kisolate(int retry)
 {
-  for (int i = 0; i < NUM_SUPERPAGES; i++) {
-      if (superpages[i] == ptr) {  // 找到对应的超级页
-          superpage_used[i] = 0;  // 标记为未使用
-          memset(ptr, 1, SUPERPGSIZE);  // 填充内存以防止悬空引用
-          return;
+  uint64 first, r, i, nfree, best = 0, bestfree = 0;
+  int stuck = 0;
+
+  kdrain();
+  acquire(&kmem.lock);
+  first = PA2IDX(SUPERPGROUNDUP((uint64)(pages + npages)));
+  for(r = first; r + SUPERPGSIZE/PGSIZE <= npages; r += SUPERPGSIZE/PGSIZE){
+    nfree = 0;
+    for(i = r; i < r + SUPERPGSIZE/PGSIZE; ){
+      if(pages[i].free){
+        nfree += 1L << pages[i].order;
+        i += 1L << pages[i].order;
+      } else {
+        i++;
       }
+    }
+    if(nfree < KCOMPACTMIN || nfree == SUPERPGSIZE/PGSIZE)
+      continue;
+    if(pages[r].stuck){
+      stuck = 1;
+      continue;
+    }
+    if(nfree > bestfree){
+      best = r;
+      bestfree = nfree;
+    }
   }
+  if(bestfree == 0 && stuck && retry){
+    for(r = first; r < npages; r += SUPERPGSIZE/PGSIZE)
+      pages[r].stuck = 0;
+    release(&kmem.lock);
+    return kisolate(0);
+  }
+  if(bestfree > 0)
+    kmem.isolated = IDX2PA(best);
+  release(&kmem.lock);
+  return bestfree > 0 ? IDX2PA(best) : 0;
+}
+
+// Let the allocator use the region kisolate() chose again.
+// Returns 1 if it is now a free 2MB block, else 0, and
+// kisolate() will pass it over.
+int
+kunisolate(void)
+{
+  uint64 idx;
+  int ok;
+
+  // pages freed just before the region was isolated may
+  // be in a hart cache.
+  kdrain();
+  acquire(&kmem.lock);
+  idx = PA2IDX(kmem.isolated);
+  ok = pages[idx].free && pages[idx].order == MAXORDER;
+  if(!ok)
+    pages[idx].stuck = 1;
+  kmem.isolated = 0;
+  release(&kmem.lock);
+  return ok;
+}
+
+// Return the number of free 4KB pages, counting those in the
+// hart caches and the zeroed pools. Read without locks, so
+// only an estimate while other harts allocate and free.
+uint64
+kfreepages(void)
+{
+  uint64 n;
+
+  n = kmem.nfree + kzero.npages + (uint64)kzero.nsupers * (SUPERPGSIZE/PGSIZE);
+  for(int i = 0; i < NCPU; i++)
+    n += kcpu[i].nfree;
+  return n;
+}
+
+// Return the number of 4KB pages the allocator manages.
+uint64
+ktotalpages(void)
+{
+  return kmem.ntotal;
+}
+
+// Return the number of free superpages, an estimate like
+// kfreepages().
+uint64
+kfreesupers(void)
+{
+  return kmem.nsuper + kzero.nsupers;
 }
@@ -0,0 +1,183 @@
+// Same-page merging: finding user pages with the same contents,
+// in one process or several, and mapping a single physical page
+// in place of all of them, read-only. A write to a merged page
+// is a copy-on-write fault, which gives the writer its own copy
+// again, as after fork().
+//
+// Once a tick, the swapd thread calls ksmscan(), which moves a
+// hand over the user pages of the parked processes that swap.c
+// may touch too, hashing up to KSMSCAN pages. A page whose contents match a
+// merged page is replaced by it. Otherwise the page goes in a
+// table of candidates, and if a candidate with the same contents
+// is there already, the page becomes a merged page itself, for
+// the hand to merge its twin and any others into when it gets to
+// them. Both tables are small and direct-mapped by hash, with no
+// references held, so entries are only hints: a merged page is
+// checked with kgetksm() and its contents compared before use.
+//
+// Superpages and pages that vmamovable() refuses are left alone.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define KSMHASH 1024  // entries in each table
+#define KSMSCAN 32    // pages ksmscan() hashes at most
+#define KSMWALK 1024  // PTEs it looks at at most
+
+extern struct proc *procs;
+
+struct ksment {
+  uint64 hash;
+  uint64 pa;
+};
+
+struct {
+  struct spinlock lock;        // protects everything but the counts
+  struct proc *hand;           // the process...
+  uint64 handva;               // ...and the address the hand is at
+  struct ksment merged[KSMHASH];
+  struct ksment cand[KSMHASH];
+  uint64 nmerged;              // pages merged, ever
+  uint64 nbroken;              // writes to merged pages, ever
+} ksm;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+}
+
+static uint64
+pagehash(uint64 *w)
+{
+  uint64 h = 14695981039346656037UL;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    h = (h ^ w[i]) * 1099511628211UL;
+  return h;
+}
+
+// The page at va that pte maps in p is now read-only, or
+// copy-on-write if it was writable.
+static void
+ksmprotect(struct proc *p, uint64 va, pte_t *pte)
+{
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  if(p == myproc())
+    uvmflush(p->pagetable, va, PGSIZE);
+  else
+    p->tlbstale = (1L << NCPU) - 1;
+}
+
+// Merge, or note as a candidate, the page at va that pte maps
+// in p. Caller holds ksm.lock and p->lock.
+static void
+ksmpage(struct proc *p, uint64 va, pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte), h;
+  struct ksment *m, *c;
+
+  if(kisksm((void*)pa))
+    return;
+  h = pagehash((uint64*)pa);
+  m = &ksm.merged[h % KSMHASH];
+  c = &ksm.cand[h % KSMHASH];
+
+  if(m->pa && m->hash == h && kgetksm((void*)m->pa)){
+    if(memcmp((void*)m->pa, (void*)pa, PGSIZE) == 0){
+      *pte = PA2PTE(m->pa) | PTE_FLAGS(*pte);
+      ksmprotect(p, va, pte);
+      kfree((void*)pa);
+      ksm.nmerged++;
+      return;
+    }
+    kfree((void*)m->pa);
+  }
+
+  // c->pa may have been freed and reused since; reading it
+  // does no harm, and a match is a match.
+  if(c->pa && c->pa != pa && c->hash == h &&
+     memcmp((void*)c->pa, (void*)pa, PGSIZE) == 0){
+    ksmprotect(p, va, pte);
+    kmarkksm((void*)pa);
+    m->hash = h;
+    m->pa = pa;
+    c->pa = 0;
+    return;
+  }
+  c->hash = h;
+  c->pa = pa;
+}
+
+// Hash a few more pages, merging those that match. Called by
+// swapd(), which has no user pages of its own.
+void
+ksmscan(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 va;
+  int n, nhash = 0;
+
+  acquire(&ksm.lock);
+  for(n = 0; n < KSMWALK && nhash < KSMSCAN; n++){
+    if(ksm.hand == 0)
+      ksm.hand = procs;
+    p = ksm.hand;
+    acquire(&p->lock);
+    pte = 0;
+    if(p->pagetable && p->parked && p->state == RUNNABLE)
+      pte = walknext(p->pagetable, &ksm.handva);
+    if(pte == 0){
+      // on to the next process.
+      release(&p->lock);
+      ksm.hand = p->next;
+      ksm.handva = 0;
+      continue;
+    }
+    va = ksm.handva;
+    ksm.handva += (*pte & PTE_SUPER) ? SUPERPGSIZE : PGSIZE;
+    if((*pte & PTE_SUPER) == 0 && vmamovable(p, va, *pte)){
+      ksmpage(p, va, pte);
+      nhash++;
+    }
+    release(&p->lock);
+  }
+  release(&ksm.lock);
+}
+
+// Move the hand on from p, which is leaving the list of procs.
+void
+ksmforget(struct proc *p)
+{
+  acquire(&ksm.lock);
+  if(ksm.hand == p){
+    ksm.hand = p->next;
+    ksm.handva = 0;
+  }
+  release(&ksm.lock);
+}
+
+// Count a write to the page at pa if it is a merged page that
+// is still shared. Called by cowfault().
+void
+ksmbreak(uint64 pa)
+{
+  if(kisksm((void*)pa) && krefcnt((void*)pa) > 1)
+    __atomic_fetch_add(&ksm.nbroken, 1, __ATOMIC_RELAXED);
+}
+
+// Report how many pages have been merged and how many writes
+// have broken merged pages apart, ever.
+void
+ksmstat(uint64 *merged, uint64 *broken)
+{
+  *merged = ksm.nmerged;
+  *broken = ksm.nbroken;
+}
@@ -16,7 +16,9 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    fdtinit();       // how much RAM there is
     kinit();         // physical page allocator
+    kmallocinit();   // small object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -27,8 +29,13 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipes
+    shminit();       // shared memory objects
+    vmainit();       // pages of MAP_SHARED files
+    ksminit();       // same-page merging
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    swapdinit();     // background paging and page merging
     __sync_synchronize();
     started = 1;
   } else {
@@ -15,7 +15,7 @@
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
-// PHYSTOP -- end RAM used by the kernel
+// phystop -- end RAM used by the kernel, from the device tree
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -39,9 +39,11 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to phystop,
+// which fdtinit() finds in the device tree.
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSDEFAULT (KERNBASE + 128*1024*1024) // if there's no device tree
+#define PHYSMAX (KERNBASE + 64L*1024*1024*1024) // most RAM the kernel will use
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -67,5 +69,34 @@
 
 struct usyscall {
   int pid;  // Process ID
+  int ppid; // Parent's process ID
 };
+
+// A page that the kernel shares, read-only, with every process,
+// so that user code can read the time without a system call.
+// The kernel makes seq odd while it updates ticks and tickstime,
+// and even again after; a reader that sees seq odd, or changed
+// by the time it has read them, must read them again.
+#define UVDATA (USYSCALL - PGSIZE)
+#define VDATA_VERSION 1
+
+struct vdata {
+  uint version;     // VDATA_VERSION
+  uint seq;
+  uint64 ticks;     // timer interrupts since boot
+  uint64 tickstime; // rdtime at the last one
+  uint64 timefreq;  // rdtime counts per second
+  uint64 boottime;  // rdtime when the kernel started
+};
+#endif
+
+// rdtime counts per second on qemu's virt machine.
+#define TIMEFREQ 10000000L
+
+// mmap() places areas downward from MMAPTOP, while the
+// heap grows up towards them.
+#ifdef LAB_PGTBL
+#define MMAPTOP UVDATA
+#else
+#define MMAPTOP TRAPFRAME
 #endif
@@ -5,10 +5,43 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Every allocated struct proc, through next. The list may be
+// walked without a lock by code that neither sleeps nor yields
+// on the way, so with interrupts off outside the scheduler.
+// procunlink() takes a freed proc off the list, leaving its
+// next alone for walks that are on it, and it goes back to
+// proccache only once every hart running scheduler() has since
+// been round the top of its loop, after which no walk can be.
+struct proc *procs;
+static struct kcache *proccache;
+struct spinlock procs_lock;   // protects changes to procs, and procsgc
+struct {
+  struct proc *dead;  // unlinked since the grace period began
+  struct proc *limbo; // unlinked before it began, to be freed
+  uint64 harts;       // harts running scheduler()
+  uint64 wait;        // harts yet to go round, 0 if none
+} procsgc;
+
+// Each proc has a slot for its kernel stack at KSTACK(n) in the
+// kernel page table, with an unmapped guard page below. A stack
+// is mapped when its process is allocated and unmapped, and its
+// slot put on kslots for reuse, when it is freed; a hart may go
+// on caching the old mapping, so every hart in kstackstale must
+// flush its TLB before switching to a process, which may be on
+// a new stack in the same slot.
+struct kslot {
+  struct kslot *next;  // on kslots, if free
+  int n;
+};
+struct spinlock kstack_lock;  // protects kernel page table changes, kslots
+static struct kslot *kslots;  // free slots
+static int nkslots;           // slots ever made
+uint64 kstackstale;
+extern pagetable_t kernel_pagetable;
 
 struct proc *initproc;
 
@@ -18,7 +51,6 @@ struct spinlock pid_lock;
 extern void forkret(void);
 static void freeproc(struct proc *p);
 
-extern char trampoline[]; // trampoline.S
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -26,36 +58,79 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Give p a kernel stack, mapped in its slot.
+// Returns 0 on success, -1 if out of memory.
+static int
+kstackalloc(struct proc *p)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  struct kslot *ks;
+  uint64 va;
+  pte_t *pte;
+  char *pa;
+
+  acquire(&kstack_lock);
+  if((ks = kslots) != 0)
+    kslots = ks->next;
+  release(&kstack_lock);
+  if(ks == 0){
+    if((ks = kmalloc(sizeof(*ks))) == 0)
+      return -1;
+    acquire(&kstack_lock);
+    ks->n = nkslots++;
+    release(&kstack_lock);
+  }
+  va = KSTACK(ks->n);
+
+  if((pa = kalloc()) == 0)
+    goto bad;
+  acquire(&kstack_lock);
+  if((pte = walk(kernel_pagetable, va, 1)) == 0){
+    release(&kstack_lock);
+    kfree(pa);
+    goto bad;
   }
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+  release(&kstack_lock);
+  p->kstack = va;
+  p->kslot = ks;
+  return 0;
+
+bad:
+  acquire(&kstack_lock);
+  ks->next = kslots;
+  kslots = ks;
+  release(&kstack_lock);
+  return -1;
+}
+
+// Free p's kernel stack, which nothing may be running on.
+static void
+kstackfree(struct proc *p)
+{
+  pte_t *pte;
+
+  acquire(&kstack_lock);
+  pte = walk(kernel_pagetable, p->kstack, 0);
+  kfree((void*)PTE2PA(*pte));
+  *pte = 0;
+  // stale before the slot can be reused.
+  __atomic_fetch_or(&kstackstale, (1L << NCPU) - 1, __ATOMIC_RELEASE);
+  p->kslot->next = kslots;
+  kslots = p->kslot;
+  release(&kstack_lock);
+  p->kstack = 0;
+  p->kslot = 0;
 }
 
-// initialize the proc table.
+// initialize the process list.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&procs_lock, "procs");
+  initlock(&kstack_lock, "kstack");
+  proccache = kcachecreate("proc", sizeof(struct proc), 0);
 }
 
 // Must be called with interrupts disabled,
@@ -102,50 +177,38 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Make a new proc and add it to the list.
+// Initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
-
-found:
+  if((p = kcachealloc(proccache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+  acquire(&p->lock);
   p->pid = allocpid();
   p->state = USED;
 
+  if(kstackalloc(p) < 0)
+    goto bad;
+
   // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0)
+    goto bad;
 
   //开辟并初始化共享页面
-  if ((p->usyscall = (struct usyscall *) kalloc()) == 0) {
-      freeproc(p);
-      release(&p->lock);
-      return 0;
-  }
+  if ((p->usyscall = (struct usyscall *) kalloc_zeroed()) == 0)
+    goto bad;
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
+  if(p->pagetable == 0)
+    goto bad;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -155,7 +218,77 @@ found:
 
   //保存pid
   p->usyscall->pid = p->pid;
+
+  acquire(&procs_lock);
+  p->next = procs;
+  __sync_synchronize();  // p is ready before others can see it
+  procs = p;
+  release(&procs_lock);
   return p;
+
+bad:
+  // no one else has seen p.
+  freeproc(p);
+  release(&p->lock);
+  kcachefree(proccache, p);
+  return 0;
+}
+
+// Start a grace period for the procs unlinked since the last
+// one, if there are any and none is under way.
+// Caller must hold procs_lock.
+static void
+procsgcstart(void)
+{
+  if(procsgc.wait || procsgc.limbo || procsgc.dead == 0)
+    return;
+  procsgc.limbo = procsgc.dead;
+  procsgc.dead = 0;
+  procsgc.wait = procsgc.harts;
+}
+
+// Take p, which freeproc() has freed and whose lock isn't
+// held, off the list of procs. The clock hands of swap.c and
+// ksm.c move on past it, in step with the unlinking, so that
+// they can't come back to it.
+static void
+procunlink(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&procs_lock);
+  for(pp = &procs; *pp != p; pp = &(*pp)->next)
+    ;
+  *pp = p->next;
+  swapforget(p);
+  ksmforget(p);
+  p->gcnext = procsgc.dead;
+  procsgc.dead = p;
+  procsgcstart();
+  release(&procs_lock);
+}
+
+// This hart is at the top of scheduler()'s loop, and so in no
+// walk of procs. Free the procs in limbo if it was the last
+// hart the grace period was waiting for.
+static void
+procsquiesce(void)
+{
+  uint64 me = 1L << cpuid();
+  struct proc *p;
+
+  if((__atomic_load_n(&procsgc.wait, __ATOMIC_ACQUIRE) & me) == 0)
+    return;
+  acquire(&procs_lock);
+  procsgc.wait &= ~me;
+  if(procsgc.wait == 0){
+    while((p = procsgc.limbo) != 0){
+      procsgc.limbo = p->gcnext;
+      kcachefree(proccache, p);
+    }
+    procsgcstart();
+  }
+  release(&procs_lock);
 }
 
 // free a proc structure and the data hanging from it,
@@ -167,9 +300,13 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->kstack)
+    kstackfree(p);
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->asidgen = 0;
+  p->tlbstale = 0;
   if (p->usyscall) {
     kfree((void*)p->usyscall);
   }
@@ -196,34 +333,14 @@ proc_pagetable(struct proc *p)
   if(pagetable == 0)
     return 0;
 
-  // map the trampoline code (for system call return)
-  // at the highest user virtual address.
-  // only the supervisor uses it, on the way
-  // to/from user space, so not PTE_U.
-  if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
-    return 0;
-  }
-
-  // map the trapframe page just below the trampoline page, for
-  // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
-    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+  // map the trampoline code (for system call return) at the
+  // highest user virtual address, the trapframe page just below
+  // it for trampoline.S, then the usyscall and vdata pages.
+  if(uvmtopmap(pagetable, (uint64)p->trapframe, (uint64)p->usyscall) < 0){
     uvmfree(pagetable, 0);
     return 0;
   }
 
-  // 在进程创建页表之时,将物理页面映射至USYSCALL处
-  if (mappages(pagetable, USYSCALL, PGSIZE,
-                (uint64) (p->usyscall), PTE_R | PTE_U) < 0) {
-      uvmunmap(pagetable, TRAPFRAME, 1, 0);
-      uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-      uvmfree(pagetable, 0);
-      return 0;
-  }
-
   return pagetable;
 }
 
@@ -232,9 +349,7 @@ proc_pagetable(struct proc *p)
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
-  uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmtopunmap(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -277,6 +392,31 @@ userinit(void)
   release(&p->lock);
 }
 
+// swapd's first scheduling by scheduler() switches here.
+static void
+swapdstart(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  swapd();
+}
+
+// Start the swapd kernel thread; see swapd() in swap.c. It has
+// a proc, so that it can sleep, but no user memory, and never
+// returns to user space.
+void
+swapdinit(void)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("swapdinit");
+  p->context.ra = (uint64)swapdstart;
+  safestrcpy(p->name, "swapd", sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -287,12 +427,16 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // only reserve the address space; vmfault() allocates
+    // each page when it is first touched.
+    if(sz + n > MMAPTOP || vmaoverlap(p, PGROUNDUP(sz), sz + n))
       return -1;
-    }
-    printf("growproc: pid = %d, sz = %ld\n", p->pid, sz);
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    sz += n;
+  } else if(n < 0 && sz + n < sz){
+    // fails if there's no memory to split a superpage.
+    if(uvmdealloc(p->pagetable, sz, sz + n) != sz + n)
+      return -1;
+    sz += n;
   }
   p->sz = sz;
   return 0;
@@ -316,9 +460,16 @@ fork(void)
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
+    procunlink(np);
     return -1;
   }
   np->sz = p->sz;
+  if(vmadup(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    procunlink(np);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -340,6 +491,178 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->usyscall->ppid = p->pid;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process that borrows the parent's address space,
+// rather than copying it, until it calls exec() or exit(); the
+// parent sleeps until then. Starting a program this way costs the
+// same however big the parent is.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct trapframe tf;
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // the child runs on p's page table, and so on p's trapframe
+  // and usyscall pages; set p's own registers aside until it
+  // is done.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  vmadup(np, p);  // only takes references, as there are no pages to share
+  np->vforkframe = np->trapframe;
+  np->trapframe = p->trapframe;
+  tf = *(p->trapframe);
+
+  // Cause vfork to return 0 in the child.
+  np->trapframe->a0 = 0;
+
+  // increment reference counts on open file descriptors.
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+  np->vforkparent = p;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->usyscall->ppid = p->pid;
+  // the usyscall page that np sees is p's; show np's ids in
+  // it until vforkrelease() puts p's back.
+  *(p->usyscall) = *(np->usyscall);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  // np can't be freed before p waits for it.
+  acquire(&wait_lock);
+  while(np->vforkparent == p)
+    sleep(p, &wait_lock);
+  release(&wait_lock);
+
+  *(p->trapframe) = tf;
+  // the child's changes to the page table were flushed under
+  // its own ASID.
+  p->tlbstale = (1L << NCPU) - 1;
+
+  return pid;
+}
+
+// Hand the address space that vfork() child p borrowed back to
+// its parent, and wake the parent up. For exec() and exit().
+void
+vforkrelease(struct proc *p)
+{
+  struct proc *pp = p->vforkparent;
+
+  pp->sz = p->sz;
+  begin_op();
+  vmarelease(p->vma, NVMA);
+  end_op();
+  p->trapframe = p->vforkframe;
+  p->vforkframe = 0;
+  p->pagetable = 0;
+  p->sz = 0;
+
+  acquire(&wait_lock);
+  pp->usyscall->pid = pp->pid;
+  pp->usyscall->ppid = pp->parent ? pp->parent->pid : 0;
+  p->vforkparent = 0;
+  wakeup(pp);
+  release(&wait_lock);
+}
+
+// Create a new process running the program path with arguments
+// argv, as fork() followed by exec() would, but without copying
+// the parent's memory. The child starts with the parent's open
+// files; then each pair (fd, pfd) in fdmap, which ends with -1,
+// makes the child's fd a copy of the parent's pfd, or closes it
+// if pfd is -1.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pfd, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct file *f;
+
+  for(i = 0; fdmap[i] != -1; i += 2){
+    fd = fdmap[i];
+    pfd = fdmap[i+1];
+    if(fd < 0 || fd >= NOFILE || pfd < -1 || pfd >= NOFILE ||
+       (pfd >= 0 && p->ofile[pfd] == 0))
+      return -1;
+  }
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // exec() sleeps. no one else looks at np until it has a parent.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  for(i = 0; fdmap[i] != -1; i += 2){
+    fd = fdmap[i];
+    pfd = fdmap[i+1];
+    f = pfd >= 0 ? filedup(p->ofile[pfd]) : 0;
+    if(np->ofile[fd])
+      fileclose(np->ofile[fd]);
+    np->ofile[fd] = f;
+  }
+  np->cwd = idup(p->cwd);
+
+  if((argc = kexec(np, path, argv)) < 0){
+    for(i = 0; i < NOFILE; i++){
+      if(np->ofile[i]){
+        fileclose(np->ofile[i]);
+        np->ofile[i] = 0;
+      }
+    }
+    begin_op();
+    iput(np->cwd);
+    end_op();
+    np->cwd = 0;
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    procunlink(np);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->usyscall->ppid = p->pid;
   release(&wait_lock);
 
   acquire(&np->lock);
@@ -356,9 +679,13 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
+  for(pp = procs; pp; pp = pp->next){
     if(pp->parent == p){
       pp->parent = initproc;
+      // unless pp has lent its usyscall page to a vfork()
+      // child; vforkrelease() sets pp's ppid then.
+      if(pp->usyscall->pid == pp->pid)
+        pp->usyscall->ppid = initproc->pid;
       wakeup(initproc);
     }
   }
@@ -375,6 +702,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  if(p->vforkparent)
+    vforkrelease(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -384,6 +714,9 @@ exit(int status)
     }
   }
 
+  vmaexit(p);
+  shmexit(p);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -418,12 +751,16 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if(addr != 0 && uvmprefault(p->pagetable, addr, sizeof(int), 1) < 0)
+    return -1;
+
   acquire(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
+    for(pp = procs; pp; pp = pp->next){
       if(pp->parent == p){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
@@ -441,6 +778,7 @@ wait(uint64 addr)
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          procunlink(pp);
           return pid;
         }
         release(&pp->lock);
@@ -472,16 +810,28 @@ scheduler(void)
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  acquire(&procs_lock);
+  procsgc.harts |= 1L << cpuid();
+  release(&procs_lock);
   for(;;){
+    procsquiesce();
+
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
     int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
+    for(p = procs; p; p = p->next) {
       acquire(&p->lock);
       if(p->state == RUNNABLE) {
+        // p's kernel stack may be in a slot this hart's TLB
+        // still holds an old mapping for.
+        if(__atomic_load_n(&kstackstale, __ATOMIC_ACQUIRE) & (1L << cpuid())){
+          __atomic_fetch_and(&kstackstale, ~(1L << cpuid()), __ATOMIC_ACQ_REL);
+          sfence_vma();
+        }
+
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
@@ -496,8 +846,8 @@ scheduler(void)
       }
       release(&p->lock);
     }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+    if(found == 0 && kzeroidle() == 0 && compactidle() == 0) {
+      // nothing to run, zero or compact; stop running on this core until an interrupt.
       intr_on();
       asm volatile("wfi");
     }
@@ -604,7 +954,8 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  push_off();  // see procs
+  for(p = procs; p; p = p->next) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
@@ -613,6 +964,7 @@ wakeup(void *chan)
       release(&p->lock);
     }
   }
+  pop_off();
 }
 
 // Kill the process with the given pid.
@@ -623,7 +975,8 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  push_off();  // see procs
+  for(p = procs; p; p = p->next){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
@@ -632,10 +985,12 @@ kill(int pid)
         p->state = RUNNABLE;
       }
       release(&p->lock);
+      pop_off();
       return 0;
     }
     release(&p->lock);
   }
+  pop_off();
   return -1;
 }
 
@@ -688,25 +1043,26 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+static char *states[] = {
+[UNUSED]    "unused",
+[USED]      "used",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[ZOMBIE]    "zombie"
+};
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [USED]      "used",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   struct proc *p;
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = procs; p; p = p->next){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -717,3 +1073,44 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Copy out a struct procinfo for each process, for sysinfo(),
+// to the array of n at user address addr, stopping when it's
+// full. Returns the number of processes, or -1 on error.
+int
+procinfo(uint64 addr, int n)
+{
+  struct proc *p;
+  struct procinfo pi;
+  int nproc = 0;
+
+  // the walk can't sleep, so fault in the array beforehand.
+  if(n > 0 && uvmprefault(myproc()->pagetable, addr, (uint64)n*sizeof(pi), 1) < 0)
+    return -1;
+  push_off();  // see procs
+  for(p = procs; p; p = p->next){
+    acquire(&p->lock);
+    if(p->state == UNUSED){
+      release(&p->lock);
+      continue;
+    }
+    if(nproc < n){
+      memset(&pi, 0, sizeof(pi));
+      pi.pid = p->pid;
+      safestrcpy(pi.state, states[p->state], sizeof(pi.state));
+      safestrcpy(pi.name, p->name, sizeof(pi.name));
+      pi.sz = p->sz;
+      if(p->pagetable)
+        uvmstat(p->pagetable, &pi.resident, &pi.ptpages, &pi.superpages);
+    }
+    release(&p->lock);
+    if(nproc < n &&
+       copyout(myproc()->pagetable, addr + nproc*sizeof(pi), (char*)&pi, sizeof(pi)) < 0){
+      pop_off();
+      return -1;
+    }
+    nproc++;
+  }
+  pop_off();
+  return nproc;
+}
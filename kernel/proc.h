@@ -79,6 +79,20 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A range of user address space whose pages vmfault()
+// fills in when they are first touched (see vma.c).
+struct vma {
+  enum { VMA_NONE, VMA_EXEC, VMA_MMAP, VMA_SHM } type;
+  uint64 start;       // first address, page-aligned
+  uint64 end;         // one past the last address, page-aligned
+  int perm;           // PTE permission bits for its pages
+  int flags;          // MAP_SHARED or MAP_PRIVATE, for VMA_MMAP
+  struct inode *ip;   // file that backs the area
+  uint64 off;         // file offset of start
+  uint64 filesz;      // bytes of file data; the rest is zero
+  struct shm *shm;    // object attached, for VMA_SHM
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -105,4 +119,14 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   struct usyscall *usyscall;
+  struct vma vma[NVMA];        // demand-filled memory areas
+  uint64 asid;                 // TLB tag for pagetable, see uvmsatp()
+  uint64 asidgen;              // ASID generation asid belongs to, 0 if none
+  uint64 tlbstale;             // harts that may hold stale entries for asid
+  struct proc *vforkparent;    // whose address space a vfork() child is borrowing
+  struct trapframe *vforkframe; // own trapframe page, unused while borrowing
+  int parked;                  // yielding in usertrap(); see swap.c
+  struct kslot *kslot;         // where the kernel stack goes, see KSTACK()
+  struct proc *next;           // on the list of all procs
+  struct proc *gcnext;         // on a list of procs waiting to be freed
 };
@@ -226,6 +226,13 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp's address-space identifier field, bits 44..59.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+#define SATP2ASID(satp) (((satp) >> SATP_ASID_SHIFT) & SATP_ASID_MASK)
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -275,6 +282,22 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+#define SCOUNTEREN_TM (1L << 1) // user mode may read time
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -354,6 +377,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for address va in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -375,7 +412,11 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
 #define PTE_SUPER (1L << 8)  // 新增 PTE_SUPER 标志
+#define PTE_COW (1L << 9)    // copy-on-write: shared, writable after a copy
+#define PTE_SWAP (1L << 54)  // not valid: the page is in swap slot PTE2SLOT
 
 
 
@@ -390,6 +431,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a paged-out page's slot goes where its physical page number was.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) (((pte) & ~PTE_SWAP) >> 10)
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
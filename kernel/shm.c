@@ -0,0 +1,169 @@
+// Shared anonymous memory objects, for passing data between
+// processes without copying it through the kernel.
+// shmcreate() makes an object and returns a handle for it;
+// any process can then attach the object to its address space
+// with shmat() and later detach it with shmdt(). Attachments
+// are inherited across fork(). Each page is allocated, zeroed,
+// when some process first touches it. An object is freed when
+// its last attachment goes, or, if it was never attached, when
+// the process that created it exits.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct shm {
+  int ref;          // number of attachments
+  int used;         // slot holds an object
+  int gen;          // bumped each time the slot is reused
+  int creator;      // pid that created the object
+  uint64 npages;
+  uint64 *pages;    // physical address of each page, or 0
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+// handles name a slot and its generation, so that a handle
+// to a freed object can't reach a later one in the same slot.
+#define HANDLE(s)   ((int)((s) - shmtab.shm) + (s)->gen * NSHM)
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free object s. Caller holds shmtab.lock.
+static void
+shmfree(struct shm *s)
+{
+  for(uint64 i = 0; i < s->npages; i++)
+    if(s->pages[i])
+      kfree((void*)s->pages[i]);
+  kfree((void*)s->pages);
+  s->pages = 0;
+  s->npages = 0;
+  s->used = 0;
+}
+
+// Create an object of n bytes for process p.
+// Returns its handle, or -1.
+int
+shmcreate(struct proc *p, uint64 n)
+{
+  struct shm *s;
+  uint64 *pages;
+  int h;
+
+  if(n == 0 || n > SHMMAXPG * PGSIZE)
+    return -1;
+  if((pages = kalloc_zeroed()) == 0)
+    return -1;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(!s->used){
+      s->used = 1;
+      s->gen++;
+      s->ref = 0;
+      s->creator = p->pid;
+      s->npages = PGROUNDUP(n) / PGSIZE;
+      s->pages = pages;
+      h = HANDLE(s);
+      release(&shmtab.lock);
+      return h;
+    }
+  }
+  release(&shmtab.lock);
+  kfree(pages);
+  return -1;
+}
+
+// Look up handle h and add an attachment to it.
+// Returns the object and sets *n to its size, or returns 0.
+struct shm *
+shmget(int h, uint64 *n)
+{
+  struct shm *s;
+
+  if(h < 0)
+    return 0;
+  s = &shmtab.shm[h % NSHM];
+  acquire(&shmtab.lock);
+  if(!s->used || HANDLE(s) != h){
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->ref++;
+  *n = s->npages * PGSIZE;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Add an attachment to s, for fork().
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop an attachment to s, freeing it if it was the last.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Is s the object named by handle h?
+int
+shmis(struct shm *s, int h)
+{
+  return s != 0 && HANDLE(s) == h;
+}
+
+// Return page i of s, allocating it if no one has touched it
+// yet, with a reference added for the caller's mapping.
+// Returns 0 if out of memory.
+uint64
+shmpage(struct shm *s, uint64 i)
+{
+  uint64 pa;
+
+  acquire(&shmtab.lock);
+  if(i >= s->npages)
+    panic("shmpage");
+  if(s->pages[i] == 0)
+    s->pages[i] = (uint64)kalloc_zeroed();
+  if((pa = s->pages[i]) != 0)
+    krefinc((void*)pa);
+  release(&shmtab.lock);
+  return pa;
+}
+
+// Free the objects that exiting process p created
+// but never attached anywhere.
+void
+shmexit(struct proc *p)
+{
+  struct shm *s;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++)
+    if(s->used && s->ref == 0 && s->creator == p->pid)
+      shmfree(s);
+  release(&shmtab.lock);
+}
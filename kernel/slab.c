@@ -0,0 +1,237 @@
+// Slab allocator, for kernel objects smaller than a page.
+//
+// A cache hands out objects of one size. It carves them out of
+// slabs, single pages from kalloc() that start with a header
+// saying which of the page's objects are in use, so an object's
+// slab is found by rounding its address down. A constructor, if
+// the cache has one, runs once per object when its slab is made;
+// objects must be freed back in their constructed state (locks
+// released, say), so that kcachealloc() needn't run it again.
+//
+// Each hart keeps a magazine of free objects per cache, so that
+// kcachealloc() and kcachefree() usually touch only the calling
+// hart's magazine, with interrupts off, and take the cache lock
+// only to move KMAG/2 objects at a time to or from the slabs.
+//
+// kmalloc() and kmfree() are for memory without a cache of its
+// own, from caches of sizes 16 to 1024 bytes. There is no 2048
+// class, since a page holds only one 2048-byte object after the
+// slab header, wasting half of it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKCACHE 32   // caches
+#define KMAG    16   // objects in a hart's magazine
+#define SLABMAP 4    // words of in-use bitmap per slab
+
+struct slab {
+  struct slab *next;  // on the cache's list of partial slabs
+  struct slab *prev;
+  struct kcache *cache;
+  int inuse;          // objects handed out
+  uint64 used[SLABMAP];
+};
+
+// objects start after the header, 16-byte aligned.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15L)
+
+struct kcache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // object size
+  int perslab;         // objects per slab
+  void (*ctor)(void *);
+  struct slab *partial; // slabs with free objects
+  int nslab;
+  int nobj;            // objects out of the slabs
+  struct {
+    void *obj[KMAG];
+    int n;
+  } mag[NCPU];
+};
+
+struct {
+  struct kcache cache[NKCACHE];
+  int n;
+} kcaches;
+
+#define KMMIN   16
+#define NKMSIZE 7     // kmalloc() sizes: KMMIN, 2*KMMIN, ..., 1024
+
+static struct kcache *kmcache[NKMSIZE];
+
+// Make a cache of objects of size bytes, for use from then on.
+// ctor, if not 0, initializes each object. Called at boot.
+struct kcache *
+kcachecreate(char *name, uint size, void (*ctor)(void *))
+{
+  struct kcache *c;
+
+  if(kcaches.n == NKCACHE || size > PGSIZE - SLABHDR)
+    panic("kcachecreate");
+  c = &kcaches.cache[kcaches.n++];
+  initlock(&c->lock, "kcache");
+  c->name = name;
+  c->size = size < KMMIN ? KMMIN : (size + 7) & ~7;
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  c->ctor = ctor;
+  return c;
+}
+
+static void
+slablink(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+slabunlink(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// Take an object from c's slabs, making a new slab if all are
+// full. Returns 0 if out of memory.
+// Caller must hold c->lock.
+static void *
+slaballoc(struct kcache *c)
+{
+  struct slab *s;
+  int i;
+
+  if((s = c->partial) == 0){
+    if((s = kalloc()) == 0)
+      return 0;
+    memset(s, 0, SLABHDR);
+    s->cache = c;
+    if(c->ctor)
+      for(i = 0; i < c->perslab; i++)
+        c->ctor((char*)s + SLABHDR + i*c->size);
+    slablink(c, s);
+    c->nslab++;
+  }
+
+  for(i = 0; s->used[i/64] & (1L << (i%64)); i++)
+    ;
+  s->used[i/64] |= 1L << (i%64);
+  if(++s->inuse == c->perslab)
+    slabunlink(c, s);
+  c->nobj++;
+  return (char*)s + SLABHDR + i*c->size;
+}
+
+// Give an object back to its slab. A slab that is left empty
+// goes back to kalloc(), unless it is c's only partial slab.
+// Caller must hold c->lock.
+static void
+slabfree(struct kcache *c, void *obj)
+{
+  struct slab *s = (struct slab *)PGROUNDDOWN((uint64)obj);
+  uint64 off = (char*)obj - ((char*)s + SLABHDR);
+  int i = off / c->size;
+
+  if(s->cache != c || off % c->size != 0 || i >= c->perslab ||
+     (s->used[i/64] & (1L << (i%64))) == 0)
+    panic("kcachefree");
+  s->used[i/64] &= ~(1L << (i%64));
+  if(s->inuse-- == c->perslab)
+    slablink(c, s);
+  c->nobj--;
+  if(s->inuse == 0 && (c->partial != s || s->next)){
+    slabunlink(c, s);
+    c->nslab--;
+    kfree(s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void *
+kcachealloc(struct kcache *c)
+{
+  void *obj = 0, *o;
+  int n;
+
+  push_off();
+  n = c->mag[cpuid()].n;
+  if(n == 0){
+    acquire(&c->lock);
+    while(n < KMAG/2 && (o = slaballoc(c)) != 0)
+      c->mag[cpuid()].obj[n++] = o;
+    release(&c->lock);
+  }
+  if(n > 0)
+    obj = c->mag[cpuid()].obj[--n];
+  c->mag[cpuid()].n = n;
+  pop_off();
+  return obj;
+}
+
+// Free obj, which came from kcachealloc(c).
+void
+kcachefree(struct kcache *c, void *obj)
+{
+  int n;
+
+  push_off();
+  n = c->mag[cpuid()].n;
+  if(n == KMAG){
+    // hand half the magazine back to the slabs.
+    acquire(&c->lock);
+    while(n > KMAG/2)
+      slabfree(c, c->mag[cpuid()].obj[--n]);
+    release(&c->lock);
+  }
+  c->mag[cpuid()].obj[n++] = obj;
+  c->mag[cpuid()].n = n;
+  pop_off();
+}
+
+void
+kmallocinit(void)
+{
+  static char *names[NKMSIZE] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+  };
+
+  for(int i = 0; i < NKMSIZE; i++)
+    kmcache[i] = kcachecreate(names[i], KMMIN << i, 0);
+}
+
+// Allocate n bytes, n at most 1024.
+// Returns 0 if the memory cannot be allocated.
+void *
+kmalloc(uint n)
+{
+  int i;
+
+  for(i = 0; i < NKMSIZE; i++)
+    if(n <= (KMMIN << i))
+      return kcachealloc(kmcache[i]);
+  return 0;
+}
+
+// Free memory that kmalloc() returned.
+void
+kmfree(void *p)
+{
+  struct slab *s = (struct slab *)PGROUNDDOWN((uint64)p);
+
+  kcachefree(s->cache, p);
+}
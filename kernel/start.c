@@ -10,10 +10,14 @@ void timerinit();
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0,
+// with the address of the device tree in fdt.
 void
-start()
+start(uint64 hartid, uint64 fdt)
 {
+  if(hartid == 0)
+    fdtaddr = fdt;
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -0,0 +1,307 @@
+// Paging user memory out to the swap area, a range of disk
+// blocks after the file system that mkfs reserves.
+//
+// When free memory falls below SWAPLOW pages, swapreclaim()
+// pages out user pages until SWAPHIGH are free. The swapd kernel
+// thread calls it once a tick, and usertrap() when a page fault
+// finds no free memory, rather than on every trap. It picks them
+// with the clock (second-chance) algorithm: a hand sweeps over
+// the user pages of every process it may touch, clearing the
+// accessed bit of pages that have it and taking the first page
+// that doesn't. A paged-out page's PTE is left invalid with
+// PTE_SWAP set and the slot number where the physical address
+// was; vmfault() reads it back with swapin().
+//
+// Another process's page table may only be changed while that
+// process can't be using it: when it is parked in usertrap()
+// by a timer interrupt, waiting to run again, and we hold its
+// lock. A process that calls it from usertrap() is also fair
+// game. Copy-on-write pages and pages shared in any other way
+// stay in memory; cold superpages are split so that their pages
+// can go.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SWAPLOW   256   // page out when fewer pages than this are free
+#define SWAPHIGH  512   // until this many are
+#define SWAPBATCH 64    // at most this many pages per swapreclaim()
+#define SWAPSCAN  4096  // PTEs the hand looks at to find one victim
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+#define NSLOT      (SWAPSIZE / SLOTBLOCKS)
+
+// states of a swap slot.
+#define SLOT_FREE    0
+#define SLOT_USED    1  // holds a paged-out page
+#define SLOT_WRITING 2  // page is on its way out
+#define SLOT_DEAD    3  // freed while on its way out
+
+extern struct proc *procs;
+
+struct {
+  struct spinlock lock;     // protects slot[] and the counts
+  uint dev;
+  uint start;               // first block of the swap area
+  int nslot;                // 0 if the disk has no swap area
+  int next;                 // where to look for a free slot
+  char slot[NSLOT];
+  int nused;
+  uint64 nout;              // pages written out, ever
+  uint64 nin;               // pages read back in, ever
+
+  struct spinlock handlock; // protects the clock hand
+  struct proc *hand;        // the process...
+  uint64 handva;            // ...and the address it has reached
+
+  struct sleeplock iolock;  // protects buf
+  struct buf buf;           // bounce buffer for the disk
+} swap;
+
+// Find the swap area described by sb, on device dev.
+// Called by fsinit().
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initlock(&swap.handlock, "swaphand");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.dev = dev;
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Read or write the page at pa from or to slot.
+static void
+swaprw(int slot, char *pa, int write)
+{
+  int i;
+
+  acquiresleep(&swap.iolock);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    swap.buf.dev = swap.dev;
+    swap.buf.blockno = swap.start + slot*SLOTBLOCKS + i;
+    if(write)
+      memmove(swap.buf.data, pa + i*BSIZE, BSIZE);
+    virtio_disk_rw(&swap.buf, write);
+    if(!write)
+      memmove(pa + i*BSIZE, swap.buf.data, BSIZE);
+  }
+  releasesleep(&swap.iolock);
+}
+
+// Allocate a slot, in state SLOT_WRITING. Returns -1 if the
+// swap area is full.
+static int
+swapalloc(void)
+{
+  int i, s = -1;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.slot[s] == SLOT_FREE)
+      break;
+  }
+  if(i == swap.nslot){
+    s = -1;
+  } else {
+    swap.slot[s] = SLOT_WRITING;
+    swap.next = s + 1;
+    swap.nused++;
+  }
+  release(&swap.lock);
+  return s;
+}
+
+// Free slot, whose page is no longer wanted. If the page is
+// still being written, the writer frees the slot when done.
+// Doesn't sleep, so page tables can be freed under a spinlock.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.slot[slot] == SLOT_WRITING){
+    swap.slot[slot] = SLOT_DEAD;
+  } else {
+    swap.slot[slot] = SLOT_FREE;
+    swap.nused--;
+  }
+  release(&swap.lock);
+}
+
+// Page out one user page, chosen by the clock algorithm.
+// Returns 0 on success, -1 if the hand found nothing to page
+// out or the swap area is full.
+static int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 va, pa;
+  int n, slot;
+
+  acquire(&swap.handlock);
+  for(n = 0; n < SWAPSCAN; n++){
+    if(swap.hand == 0)
+      swap.hand = procs;
+    p = swap.hand;
+    acquire(&p->lock);
+    pte = 0;
+    if(p->pagetable && (p == myproc() || (p->parked && p->state == RUNNABLE)))
+      pte = walknext(p->pagetable, &swap.handva);
+    if(pte == 0){
+      // on to the next process.
+      release(&p->lock);
+      swap.hand = p->next;
+      swap.handva = 0;
+      continue;
+    }
+    va = swap.handva;
+    swap.handva += (*pte & PTE_SUPER) ? SUPERPGSIZE : PGSIZE;
+
+    if(!vmamovable(p, va, *pte)){
+      release(&p->lock);
+      continue;
+    }
+    // the TLB may cache the accessed bit, so p must flush
+    // before it runs again for the bit to mean anything.
+    p->tlbstale = (1L << NCPU) - 1;
+    if(*pte & PTE_A){
+      // second chance.
+      *pte &= ~PTE_A;
+      release(&p->lock);
+      continue;
+    }
+    if(*pte & PTE_SUPER){
+      // a cold superpage is split, and the hand goes back
+      // over its pages to page them out one at a time.
+      if(uvmdemote(p->pagetable, va) == 0)
+        swap.handva = va;
+      release(&p->lock);
+      continue;
+    }
+
+    if((slot = swapalloc()) < 0){
+      release(&p->lock);
+      break;
+    }
+    pa = PTE2PA(*pte);
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    uvmresident(p->pagetable, -1);
+    release(&p->lock);
+    release(&swap.handlock);
+
+    // p may fault the page back in while it is being written;
+    // swapin() waits for the write to finish.
+    swaprw(slot, (char*)pa, 1);
+    kfree((void*)pa);
+
+    acquire(&swap.lock);
+    swap.nout++;
+    if(swap.slot[slot] == SLOT_DEAD){
+      swap.slot[slot] = SLOT_FREE;
+      swap.nused--;
+    } else {
+      swap.slot[slot] = SLOT_USED;
+    }
+    wakeup(&swap.slot[slot]);
+    release(&swap.lock);
+    return 0;
+  }
+  release(&swap.handlock);
+  return -1;
+}
+
+// If free memory is short, page out user pages until there is
+// enough again. Called by swapd(), and by usertrap() where the
+// current process holds no references to its own user pages.
+// Returns the number of pages paged out.
+int
+swapreclaim(void)
+{
+  int n = 0;
+
+  if(swap.nslot == 0 || kfreepages() >= SWAPLOW)
+    return 0;
+  while(n < SWAPBATCH && kfreepages() < SWAPHIGH && swapout() == 0)
+    n++;
+  return n;
+}
+
+// The body of the swapd kernel thread. Once a tick it pages
+// out memory if free memory is short and lets ksmscan() hash a
+// few more pages, so that neither runs on every process's trap
+// path. It only reaches processes that are parked, as compact()
+// does, so usertrap() still reclaims for itself when a page
+// fault runs out of memory.
+void
+swapd(void)
+{
+  uint xticks;
+
+  for(;;){
+    swapreclaim();
+    ksmscan();
+    acquire(&tickslock);
+    xticks = ticks;
+    while(ticks == xticks)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
+
+// Move the hand on from p, which is leaving the list of procs.
+void
+swapforget(struct proc *p)
+{
+  acquire(&swap.handlock);
+  if(swap.hand == p){
+    swap.hand = p->next;
+    swap.handva = 0;
+  }
+  release(&swap.handlock);
+}
+
+// Read the paged-out page at va in pagetable back into memory.
+// Returns 0 on success, -1 if out of memory.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  int slot;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_SWAP) == 0)
+    panic("swapin");
+  slot = PTE2SLOT(*pte);
+  if((mem = kalloc()) == 0)
+    return -1;
+
+  acquire(&swap.lock);
+  while(swap.slot[slot] == SLOT_WRITING)
+    sleep(&swap.slot[slot], &swap.lock);
+  release(&swap.lock);
+
+  swaprw(slot, mem, 0);
+  *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_V | PTE_A;
+  uvmresident(pagetable, 1);
+  swapfree(slot);
+
+  acquire(&swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  return 0;
+}
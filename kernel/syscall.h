@@ -35,3 +35,10 @@
 #define SYS_recv      32
 #define SYS_pgpte     33
 #define SYS_kpgtbl    34
+#define SYS_shmcreate 35
+#define SYS_shmat     36
+#define SYS_shmdt     37
+#define SYS_spawn     38
+#define SYS_vfork     39
+#define SYS_pgaccess  40
+#define SYS_pgdirty   41
@@ -431,20 +431,18 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the null-terminated argument vector at user address
+// uargv into argv, one kalloc()ed page per string.
+// Returns 0, or -1 after freeing whatever it fetched.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,6 +458,27 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
+
+ bad:
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+  return -1;
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int i;
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
   int ret = exec(path, argv);
 
@@ -467,11 +486,40 @@ sys_exec(void)
     kfree(argv[i]);
 
   return ret;
+}
+
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int i, fdmap[2*NOFILE+1];
+  uint64 uargv, ufdmap;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufdmap);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+
+  // pairs of descriptors, ending with -1 where a pair would start.
+  fdmap[0] = -1;
+  for(i = 0; ufdmap != 0; i++){
+    if(i >= NELEM(fdmap))
+      return -1;
+    if(copyin(myproc()->pagetable, (char*)&fdmap[i], ufdmap+sizeof(int)*i, sizeof(int)) < 0)
+      return -1;
+    if(i % 2 == 0 && fdmap[i] == -1)
+      break;
+  }
+
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = spawn(path, argv, fdmap);
 
- bad:
   for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
     kfree(argv[i]);
-  return -1;
+
+  return ret;
 }
 
 uint64
@@ -503,3 +551,30 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f;
+
+  // the address hint, argument 0, is ignored.
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  return vmammap(myproc(), len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return vmaunmap(myproc(), addr, len);
+}
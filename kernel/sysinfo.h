@@ -0,0 +1,21 @@
+// What sysinfo() reports about memory.
+struct sysinfo {
+  uint64 freepages;   // free 4KB pages, counting those in free superpages
+  uint64 freesupers;  // free 2MB superpages
+  uint64 nproc;       // processes in use
+  uint64 totalpages;  // 4KB pages of RAM the kernel hands out
+  uint64 compacted;   // free superpages compaction has made, ever
+  uint64 ksmmerged;   // pages merged with identical ones, ever
+  uint64 ksmbroken;   // writes that unmerged a page, ever
+};
+
+// What sysinfo() reports about each process.
+struct procinfo {
+  int pid;
+  char state[8];
+  char name[16];
+  uint64 sz;          // bytes of user memory, not counting mmap()
+  uint64 resident;    // 4KB pages mapped; a superpage counts 512
+  uint64 ptpages;     // page-table pages
+  uint64 superpages;  // superpages mapped
+};
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 uint64
 sys_exit(void)
@@ -27,6 +28,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -43,7 +50,6 @@ sys_sbrk(void)
 
   argint(0, &n);
   addr = myproc()->sz;
-  printf("sys_sbrk: addr = %ld, n = %d\n", addr, n);
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -72,6 +78,36 @@ sys_sleep(void)
   return 0;
 }
 
+// create a shared memory object of n bytes.
+uint64
+sys_shmcreate(void)
+{
+  uint64 n;
+
+  argaddr(0, &n);
+  return shmcreate(myproc(), n);
+}
+
+// attach shared memory object h at addr, or anywhere if 0.
+uint64
+sys_shmat(void)
+{
+  int h;
+  uint64 addr;
+
+  argint(0, &h);
+  argaddr(1, &addr);
+  return vmashmat(myproc(), h, addr);
+}
+
+uint64
+sys_shmdt(void)
+{
+  int h;
+
+  argint(0, &h);
+  return vmashmdt(myproc(), h);
+}
 
 #ifdef LAB_PGTBL
 int
@@ -103,6 +139,57 @@ sys_kpgtbl(void)
 #endif
 
 
+uint64
+sys_sysinfo(void)
+{
+  struct sysinfo info;
+  uint64 addr, procs;
+  int n, nproc;
+
+  argaddr(0, &addr);
+  argaddr(1, &procs);
+  argint(2, &n);
+  if((nproc = procinfo(procs, n)) < 0)
+    return -1;
+  info.freepages = kfreepages();
+  info.freesupers = kfreesupers();
+  info.nproc = nproc;
+  info.totalpages = ktotalpages();
+  info.compacted = compacted();
+  ksmstat(&info.ksmmerged, &info.ksmbroken);
+  if(copyout(myproc()->pagetable, addr, (char*)&info, sizeof(info)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_pgaccess(void)
+{
+  uint64 va, mask;
+  int n;
+
+  argaddr(0, &va);
+  argint(1, &n);
+  argaddr(2, &mask);
+  if(n < 0)
+    return -1;
+  return uvmpgbits(myproc()->pagetable, va, n, mask, PTE_A);
+}
+
+uint64
+sys_pgdirty(void)
+{
+  uint64 va, mask;
+  int n;
+
+  argaddr(0, &va);
+  argint(1, &n);
+  argaddr(2, &mask);
+  if(n < 0)
+    return -1;
+  return uvmpgbits(myproc()->pagetable, va, n, mask, PTE_D);
+}
+
 uint64
 sys_kill(void)
 {
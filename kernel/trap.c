@@ -8,6 +8,9 @@
 
 struct spinlock tickslock;
 uint ticks;
+#ifdef LAB_PGTBL
+struct vdata *vdata;  // mapped at UVDATA in every process
+#endif
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +23,13 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+#ifdef LAB_PGTBL
+  if((vdata = kalloc_zeroed()) == 0)
+    panic("trapinit");
+  vdata->version = VDATA_VERSION;
+  vdata->timefreq = TIMEFREQ;
+  vdata->boottime = r_time();
+#endif
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +37,10 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+#ifdef LAB_PGTBL
+  // let user code read the time from the vdata page.
+  w_scounteren(r_scounteren() | SCOUNTEREN_TM);
+#endif
 }
 
 //
@@ -65,6 +79,22 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // instruction fetch, load or store to a lazily allocated,
+    // copy-on-write or paged-out page, or to program text that
+    // exec() has not read in yet. vmfault() may sleep, and
+    // compacts memory for a superpage only with interrupts on,
+    // so read the CSRs and then enable interrupts, as for a
+    // system call. if memory ran out, page some out and try again.
+    uint64 scause = r_scause(), va = r_stval();
+    int access = scause == 12 ? PTE_X : scause == 13 ? PTE_R : PTE_W;
+    intr_on();
+    if(vmfault(p->pagetable, va, access) == 0 &&
+       (swapreclaim() == 0 || vmfault(p->pagetable, va, access) == 0)){
+      printf("usertrap(): unexpected scause 0x%lx pid=%d\n", scause, p->pid);
+      printf("            sepc=0x%lx stval=0x%lx\n", p->trapframe->epc, va);
+      setkilled(p);
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,9 +106,13 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt. swapd may
+  // page p out or merge its pages meanwhile.
+  if(which_dev == 2){
+    p->parked = 1;
     yield();
+    p->parked = 0;
+  }
 
   usertrapret();
 }
@@ -119,8 +153,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with p's ASID.
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -166,6 +201,14 @@ clockintr()
   if(cpuid() == 0){
     acquire(&tickslock);
     ticks++;
+#ifdef LAB_PGTBL
+    vdata->seq++;
+    __sync_synchronize();
+    vdata->ticks = ticks;
+    vdata->tickstime = r_time();
+    __sync_synchronize();
+    vdata->seq++;
+#endif
     wakeup(&ticks);
     release(&tickslock);
   }
@@ -7,6 +7,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -17,6 +18,33 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Every user page table maps the same trampoline and vdata
+// pages at the top of the address space, in the same level-0
+// page-table page as the process's own trapframe and usyscall
+// pages. Rather than build that corner's level-1 and level-0
+// pages with walk() for each new page table and free them
+// after, uvmtopunmap() keeps a few spare pairs, the shared
+// leaves still in place, for uvmtopmap() to reuse.
+#define NTOPSPARE 16
+
+struct {
+  struct spinlock lock;
+  pagetable_t spare[NTOPSPARE];  // level-1 pages
+  int n;
+} uvmtop;
+
+// Untouched zero-fill user memory maps these, read-only or
+// copy-on-write, until it is written. The kernel keeps a
+// reference to each, so cowfault() always copies them.
+static char *zeropage;   // a 4KB page of zeros
+static char *zerosuper;  // a 2MB superpage of zeros
+
+void freewalk(pagetable_t);
+static void *supercompact(void);
+static int mapzero(pagetable_t, uint64, uint64, int);
+static int heappromote(struct proc*, uint64);
+static void ptstatinit(void);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -43,27 +71,53 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
-  // map kernel text executable and read-only.
+  // map kernel text executable and read-only. kvmmap() uses
+  // 4KB pages around etext, where the permissions change, and
+  // 2MB pages for the rest of RAM.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, phystop-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // allocproc() maps each process's kernel stack below it.
+
   return kpgtbl;
 }
 
+// Every user page table runs tagged with an ASID, so that its
+// TLB entries survive trips through the kernel (ASID 0) and
+// switches to other processes. ASIDs are handed out in
+// generations: when a generation's ASIDs run out, a new one
+// begins, every process must take a new ASID before it next
+// runs, and every hart flushes its TLB once before using the
+// new generation's ASIDs.
+struct {
+  struct spinlock lock;
+  uint64 gen;     // current generation
+  uint64 next;    // next unused ASID in this generation
+  uint64 max;     // largest ASID the hardware implements
+  uint64 stale;   // harts that must flush before using gen's ASIDs
+} asids;
+
+// uvmflush() flushes a whole ASID rather than more pages than this.
+#define TLBFLUSHPAGES 32
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
 {
+  ptstatinit();
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0 || (zerosuper = superalloc_zeroed()) == 0)
+    panic("kvminit: zero pages");
+  initlock(&asids.lock, "asids");
+  initlock(&uvmtop.lock, "uvmtop");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -74,12 +128,159 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // find out how many ASID bits the hardware implements: satp
+  // keeps only those bits of an all-ones ASID.
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+  asids.max = SATP2ASID(r_satp());
+
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Return the satp value for running p's page table on this
+// hart, first giving p an ASID from the current generation if
+// it has none, and flushing whatever this hart's TLB may hold
+// that p must not see. Called by usertrapret() with interrupts
+// off.
+uint64
+uvmsatp(struct proc *p)
+{
+  uint64 bit = 1L << cpuid();
+
+  if(asids.max == 0)
+    return MAKE_SATP(p->pagetable);   // no ASIDs; trampoline flushes
+
+  if(p->asidgen != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      // out of ASIDs: start a new generation.
+      asids.gen++;
+      asids.next = 1;
+      asids.stale = (1L << NCPU) - 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = asids.gen;
+    p->tlbstale = 0;
+    release(&asids.lock);
+  }
+
+  if(__atomic_load_n(&asids.stale, __ATOMIC_ACQUIRE) & bit){
+    __atomic_fetch_and(&asids.stale, ~bit, __ATOMIC_ACQ_REL);
+    sfence_vma();
+  } else if(p->tlbstale & bit){
+    sfence_vma_asid(p->asid);
+  }
+  p->tlbstale &= ~bit;
+
+  return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// Flush stale TLB entries after a change to the mappings of
+// [va, va+len) in pagetable. Only the current process's page
+// table can be cached in a TLB; others need no flushing. The
+// flush here covers this hart; any other hart the process has
+// run on flushes its ASID before the process next runs there.
+void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  push_off();
+  if(len > TLBFLUSHPAGES * PGSIZE){
+    sfence_vma_asid(p->asid);
+  } else {
+    for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+      sfence_vma_page(a, p->asid);
+  }
+  p->tlbstale |= ((1L << NCPU) - 1) & ~(1L << cpuid());
+  pop_off();
+}
+
+// What each user page table maps, for sysinfo(). The counts
+// live beside the page table, in a hash table keyed by its root
+// page: uvmcreate() adds an entry and uvmfree() removes it. The
+// kernel's page table has none, so ptstat() ignores it. A
+// vfork() child shares its parent's page table, and so the
+// parent's counts.
+#define NPTSTAT 64
+#define PTSTATHASH(pt) (((uint64)(pt) / PGSIZE) % NPTSTAT)
+#define ST_RESIDENT 0   // 4KB pages mapped; a superpage is 512
+#define ST_PTPAGES  1   // page-table pages, the root included
+#define ST_SUPER    2   // superpages mapped
+#define NST         3
+
+struct ptstat {
+  struct ptstat *next;
+  pagetable_t pagetable;
+  long n[NST];
+};
+
+struct {
+  struct spinlock lock;
+  struct ptstat *head;
+} ptstats[NPTSTAT];
+
+static void
+ptstatinit(void)
+{
+  for(int i = 0; i < NPTSTAT; i++)
+    initlock(&ptstats[i].lock, "ptstat");
+}
+
+// Find pagetable's counts. Caller holds its bucket's lock.
+static struct ptstat*
+ptstatfind(pagetable_t pagetable)
+{
+  struct ptstat *st;
+
+  for(st = ptstats[PTSTATHASH(pagetable)].head; st; st = st->next)
+    if(st->pagetable == pagetable)
+      return st;
+  return 0;
+}
+
+static void
+ptstat(pagetable_t pagetable, int i, long n)
+{
+  int h = PTSTATHASH(pagetable);
+  struct ptstat *st;
+
+  acquire(&ptstats[h].lock);
+  if((st = ptstatfind(pagetable)) != 0)
+    st->n[i] += n;
+  release(&ptstats[h].lock);
+}
+
+// Count n more resident pages in pagetable, for pages that
+// swap.c moves in (n > 0) or out (n < 0).
+void
+uvmresident(pagetable_t pagetable, long n)
+{
+  ptstat(pagetable, ST_RESIDENT, n);
+}
+
+// Report what pagetable maps.
+void
+uvmstat(pagetable_t pagetable, uint64 *resident, uint64 *ptpages, uint64 *supers)
+{
+  int h = PTSTATHASH(pagetable);
+  struct ptstat *st;
+
+  *resident = *ptpages = *supers = 0;
+  acquire(&ptstats[h].lock);
+  if((st = ptstatfind(pagetable)) != 0){
+    *resident = st->n[ST_RESIDENT];
+    *ptpages = st->n[ST_PTPAGES];
+    *supers = st->n[ST_SUPER];
+  }
+  release(&ptstats[h].lock);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -95,6 +296,8 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  pagetable_t root = pagetable;
+
   if(va >= MAXVA)
     panic("walk");
 
@@ -108,15 +311,42 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       }
 #endif
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
+      ptstat(root, ST_PTPAGES, 1);
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Like walk(), but stop at the given level and return the PTE
+// there, which is either a leaf or points to a lower-level table.
+// Used to install and look up 2MB superpage leaves (level 1).
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
+{
+  pagetable_t root = pagetable;
+
+  if(va >= MAXVA)
+    panic("walklevel");
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return 0;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+      ptstat(root, ST_PTPAGES, 1);
+    }
+  }
+  return &pagetable[PX(level, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -137,6 +367,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(*pte & PTE_SUPER)
+    pa += PGROUNDDOWN(va % SUPERPGSIZE);
   return pa;
 }
 
@@ -144,11 +376,31 @@ walkaddr(pagetable_t pagetable, uint64 va)
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses 1GB and 2MB leaf PTEs wherever va, pa and the
+// remaining size are aligned enough, 4KB PTEs elsewhere.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 last = va + sz, n;
+  pte_t *pte;
+  int level;
+
+  if((va % PGSIZE) != 0 || (pa % PGSIZE) != 0)
+    panic("kvmmap: not aligned");
+
+  while(va < last){
+    for(level = 2; level > 0; level--){
+      n = 1L << PXSHIFT(level);
+      if(va % n == 0 && pa % n == 0 && last - va >= n)
+        break;
+    }
+    n = 1L << PXSHIFT(level);
+    if((pte = walklevel(kpgtbl, va, level, 1)) == 0 || (*pte & PTE_V))
+      panic("kvmmap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    va += n;
+    pa += n;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -161,7 +413,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
-  int sz;
+  uint64 sz;
 
   if (perm & PTE_SUPER) {
     sz = SUPERPGSIZE;
@@ -179,9 +431,13 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
+  last = va + size - sz;
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if(sz == SUPERPGSIZE)
+      pte = walklevel(pagetable, a, 1, 1);
+    else
+      pte = walk(pagetable, a, 1);
+    if(pte == 0)
       return -1;
     if(*pte & PTE_V)
       {
@@ -189,54 +445,197 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
         panic("mappages: remap");
       }
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if (*pte == 540576023) printf("mappages: va=%ld, pte=%ld\n", a, *pte);
+    ptstat(pagetable, ST_RESIDENT, sz / PGSIZE);
+    if(sz == SUPERPGSIZE)
+      ptstat(pagetable, ST_SUPER, 1);
     if(a == last)
       break;
-    a += PGSIZE;
-    if (sz == PGSIZE) pa += PGSIZE;
+    a += sz;
+    pa += sz;
+  }
+  return 0;
+}
+
+// Split the superpage leaf mapping the 2MB region at va into a
+// level-0 table of 512 base-page PTEs with the same permissions.
+// A superpage held only by this page table is cut up in place;
+// one still shared copy-on-write is copied into private 4KB pages
+// instead, since its other holders keep mapping it whole.
+// Returns 0 on success (or if va isn't in a superpage), -1 if
+// out of memory.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *l1;
+  pagetable_t l0;
+  uint64 pa, flags;
+  char *mem;
+  int i;
+
+  va -= va % SUPERPGSIZE;
+  l1 = walklevel(pagetable, va, 1, 0);
+  if(l1 == 0 || (*l1 & PTE_V) == 0 || (*l1 & PTE_SUPER) == 0)
+    return 0;
+  pa = PTE2PA(*l1);
+  flags = PTE_FLAGS(*l1) & ~PTE_SUPER;
+
+  if((l0 = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  if(pa == (uint64)zerosuper){
+    // still untouched: map the zero page 512 times instead.
+    for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+      l0[i] = PA2PTE(zeropage) | flags;
+      krefinc(zeropage);
+    }
+    superfree((void*)pa);
+  } else if(krefcnt((void*)pa) == 1){
+    kdemote((void*)pa);
+    for(i = 0; i < SUPERPGSIZE/PGSIZE; i++)
+      l0[i] = PA2PTE(pa + (uint64)i * PGSIZE) | flags;
+  } else {
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;
+    for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+      if((mem = kalloc()) == 0){
+        while(--i >= 0)
+          kfree((void*)PTE2PA(l0[i]));
+        kfree((void*)l0);
+        return -1;
+      }
+      memmove(mem, (char*)pa + i*PGSIZE, PGSIZE);
+      l0[i] = PA2PTE(mem) | flags;
+    }
+    superfree((void*)pa);
+  }
+  *l1 = PA2PTE(l0) | PTE_V;
+  ptstat(pagetable, ST_PTPAGES, 1);
+  ptstat(pagetable, ST_SUPER, -1);
+  uvmflush(pagetable, va, SUPERPGSIZE);
+  return 0;
+}
+
+// Return the next valid user leaf PTE of pagetable, a page or a
+// superpage, at or above *va and below MMAPTOP, setting *va to
+// the address it maps. Returns 0 if there is none. Skips
+// unmapped regions a whole page-table page at a time, so a
+// sparse address space is quick to cross.
+pte_t *
+walknext(pagetable_t pagetable, uint64 *va)
+{
+  uint64 a = *va;
+  pagetable_t pt;
+  pte_t *pte;
+  int level;
+
+  while(a < MMAPTOP){
+    pt = pagetable;
+    for(level = 2; level > 0; level--){
+      pte = &pt[PX(level, a)];
+      if((*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+        break;
+      pt = (pagetable_t)PTE2PA(*pte);
+    }
+    if(level == 0)
+      pte = &pt[PX(0, a)];
+    if(level <= 1 && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+      *va = a - a % (1L << PXSHIFT(level));
+      return pte;
+    }
+    // on to the next entry at this level.
+    a = (a | ((1L << PXSHIFT(level)) - 1)) + 1;
   }
   return 0;
 }
 
+// superalloc_zeroed(), but if no 2MB block is free, compact
+// memory to make one. Only if interrupts are on, which means
+// the caller holds no spinlock, as compact() requires; so
+// for user page faults, which usertrap() handles with
+// interrupts on, and for copyin() and copyout().
+static void *
+supercompact(void)
+{
+  void *mem;
+
+  if((mem = superalloc_zeroed()) == 0 && intr_get() && compact())
+    mem = superalloc_zeroed();
+  return mem;
+}
+
+// Map the zero page at va, or the zero superpage if sz is
+// SUPERPGSIZE, copy-on-write if perm allows writing.
+// Returns 0 on success, -1 if out of memory.
+static int
+mapzero(pagetable_t pagetable, uint64 va, uint64 sz, int perm)
+{
+  uint64 pa = sz == SUPERPGSIZE ? (uint64)zerosuper : (uint64)zeropage;
+
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(sz == SUPERPGSIZE)
+    perm |= PTE_SUPER;
+  if(mappages(pagetable, va, sz, pa, perm) != 0)
+    return -1;
+  krefinc((void*)pa);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never allocated are skipped.
+// A superpage only partly inside the range is demoted first,
+// so that just the pages in the range go.
 // Optionally free the physical memory.
-void
+// Returns 0 on success, or -1, with nothing unmapped, if there
+// is no memory to demote a superpage at either end.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, sz, end = va + npages*PGSIZE;
   pte_t *pte;
-  int sz;
-  int super_flag;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += sz){
+  // only the superpages at the ends can be cut in two; split
+  // them before anything goes, so that failing leaves the
+  // range as it was.
+  if((va % SUPERPGSIZE != 0 && uvmdemote(pagetable, va) != 0) ||
+     (end % SUPERPGSIZE != 0 && uvmdemote(pagetable, end) != 0))
+    return -1;
+
+  for(a = va; a < end; a += sz){
     sz = PGSIZE;
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0) {
-      printf("va=%ld pte=%ld\n", a, *pte);
-      panic("uvmunmap: not mapped");
+      continue;   // never touched; see vmfault()
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
     }
+    if((*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
 
-    if (*pte & PTE_SUPER) super_flag = 1;
-    else super_flag = 0;
+    if (*pte & PTE_SUPER)
+      sz = SUPERPGSIZE;
     
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      if (super_flag) {
-        superfree((void *)pa); // 可能会重复释放
+      if (sz == SUPERPGSIZE) {
+        superfree((void *)pa);
       } else {
         kfree((void*)pa);
       }
     }
-    // printf("uvmunmap: va=%ld, pte=%ld\n", a, *pte);
     *pte = 0;
+    ptstat(pagetable, ST_RESIDENT, -(long)(sz / PGSIZE));
+    if(sz == SUPERPGSIZE)
+      ptstat(pagetable, ST_SUPER, -1);
   }
+  uvmflush(pagetable, va, npages*PGSIZE);
+  return 0;
 }
 
 // create an empty user page table.
@@ -245,13 +644,105 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  struct ptstat *st;
+  int h;
+
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  if((st = kmalloc(sizeof(*st))) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  memset(st, 0, sizeof(*st));
+  st->pagetable = pagetable;
+  st->n[ST_PTPAGES] = 1;
+  h = PTSTATHASH(pagetable);
+  acquire(&ptstats[h].lock);
+  st->next = ptstats[h].head;
+  ptstats[h].head = st;
+  release(&ptstats[h].lock);
   return pagetable;
 }
 
+// Map the top of the address space in the new page table
+// pagetable: the trampoline and vdata pages, and the process's
+// trapframe and usyscall pages.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmtopmap(pagetable_t pagetable, uint64 trapframe, uint64 usyscall)
+{
+  pagetable_t l1 = 0, l0;
+
+  acquire(&uvmtop.lock);
+  if(uvmtop.n > 0)
+    l1 = uvmtop.spare[--uvmtop.n];
+  release(&uvmtop.lock);
+
+  if(l1 == 0){
+    if((l1 = (pagetable_t)kalloc_zeroed()) == 0)
+      return -1;
+    if((l0 = (pagetable_t)kalloc_zeroed()) == 0){
+      kfree(l1);
+      return -1;
+    }
+    l1[PX(1, TRAMPOLINE)] = PA2PTE(l0) | PTE_V;
+    // only the supervisor uses the trampoline, on the way
+    // to/from user space, so not PTE_U.
+    l0[PX(0, TRAMPOLINE)] = PA2PTE(trampoline) | PTE_R | PTE_X | PTE_V;
+#ifdef LAB_PGTBL
+    l0[PX(0, UVDATA)] = PA2PTE(vdata) | PTE_R | PTE_U | PTE_V;
+#endif
+  }
+  l0 = (pagetable_t)PTE2PA(l1[PX(1, TRAMPOLINE)]);
+  l0[PX(0, TRAPFRAME)] = PA2PTE(trapframe) | PTE_R | PTE_W | PTE_V;
+  l0[PX(0, USYSCALL)] = PA2PTE(usyscall) | PTE_R | PTE_U | PTE_V;
+  pagetable[PX(2, TRAMPOLINE)] = PA2PTE(l1) | PTE_V;
+  ptstat(pagetable, ST_PTPAGES, 2);
+  ptstat(pagetable, ST_RESIDENT, 4);
+  return 0;
+}
+
+// Undo uvmtopmap(), keeping the page-table pages for another
+// page table if there's room. User mappings at the top of the
+// address space must already be gone.
+void
+uvmtopunmap(pagetable_t pagetable)
+{
+  pte_t *pte = &pagetable[PX(2, TRAMPOLINE)];
+  pagetable_t l1, l0;
+  int i;
+
+  if((*pte & PTE_V) == 0)
+    return;
+  l1 = (pagetable_t)PTE2PA(*pte);
+  l0 = (pagetable_t)PTE2PA(l1[PX(1, TRAMPOLINE)]);
+  *pte = 0;
+  ptstat(pagetable, ST_PTPAGES, -2);
+  ptstat(pagetable, ST_RESIDENT, -4);
+
+  // mmap() areas may have needed other tables up here.
+  for(i = 0; i < 512; i++){
+    if(i != PX(1, TRAMPOLINE) && (l1[i] & PTE_V)){
+      freewalk((pagetable_t)PTE2PA(l1[i]));
+      l1[i] = 0;
+    }
+  }
+  l0[PX(0, TRAPFRAME)] = 0;
+  l0[PX(0, USYSCALL)] = 0;
+
+  acquire(&uvmtop.lock);
+  if(uvmtop.n < NTOPSPARE){
+    uvmtop.spare[uvmtop.n++] = l1;
+    l1 = 0;
+  }
+  release(&uvmtop.lock);
+  if(l1){
+    kfree(l0);
+    kfree(l1);
+  }
+}
+
 // Load the user initcode into address 0 of pagetable,
 // for the very first process.
 // sz must be less than a page.
@@ -269,113 +760,59 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 }
 
 
-// Allocate PTEs and physical memory to grow process from oldsz to
-// newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Allocate PTEs to grow process from oldsz to newsz, which need
+// not be page aligned. The new pages map the zero page, and
+// cowfault() gives each its own memory when it is first written.
+// Returns new size or 0 on error.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
-  char *mem;
   uint64 a;
-  int sz;
-  uint64 pre_size;
+#ifdef LAB_SYSCALL
+  char *mem;
+#endif
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-
-  printf("uvmalloc: oldsz %ld newsz %ld\n", oldsz, newsz);
-
-  // if a user program calls sbrk() with a size of 2 megabytes or more, and the newly created address range includes one or more areas that are two-megabyte-aligned and at least two megabytes in size, the kernel should use a single superpage (instead of hundreds of ordinary pages).
-  if (newsz - oldsz >= SUPERPGSIZE) 
-  {
-    pre_size = SUPERPGROUNDUP(oldsz) - oldsz; // 计算oldsz到第一个超级页的大小
-
-    // 对于新oldsz之前的区域，我们需要分配普通页
-    for (a = oldsz; a < oldsz + pre_size; a += PGSIZE) 
-    {
-      mem = kalloc();
-      if (mem == 0) 
-      {
-        uvmdealloc(pagetable, a, oldsz);
-        return 0;
-      }
-      memset(mem, 0, PGSIZE);
-      if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0) 
-      {
-        kfree(mem);
+  for(a = oldsz; a < newsz; a += PGSIZE){
+    // every 2MB-aligned 2MB run that lies entirely in the new
+    // range maps the zero superpage.
+    if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= newsz){
+      if(mapzero(pagetable, a, SUPERPGSIZE, PTE_R|PTE_U|xperm) != 0){
         uvmdealloc(pagetable, a, oldsz);
         return 0;
       }
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
     }
 
-    // 分配超级页
-    oldsz = SUPERPGROUNDUP(oldsz);
-    sz = SUPERPGSIZE;
-    printf("uvmalloc: superpage\n");
-    for(a = oldsz; a < newsz - sz; a += sz)
-    {
-      mem = superalloc(); // 得到一个超级页的物理内存地址
-      printf("uvmalloc: va: %ld, superalloc mem %p\n", a, mem);
-      memset(mem, 0, sz);
-      if(mappages(pagetable, a, sz, (uint64)mem, PTE_SUPER|PTE_R|PTE_U|xperm) != 0)
-      {
-        superfree(mem);
-        uvmdealloc(pagetable, a, oldsz);
-        return 0;
-      }
+#ifndef LAB_SYSCALL
+    if(mapzero(pagetable, a, PGSIZE, PTE_R|PTE_U|xperm) != 0){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
     }
-
-    // 对于新oldsz之后的区域，我们需要分配普通页
-    uint64 tail = a;
-    while (tail < newsz) 
-    {
-      mem = kalloc();
-      if (mem == 0) 
-      {
-        uvmdealloc(pagetable, oldsz, newsz);
-        return 0;
-      }
-      memset(mem, 0, PGSIZE);
-      if (mappages(pagetable, tail, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0) 
-      {
-        kfree(mem);
-        uvmdealloc(pagetable, oldsz, newsz);
-        return 0;
-      }
-      tail += PGSIZE;
+#else
+    if((mem = kalloc()) == 0){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
     }
-  }
-  else // 如果不是超级页，那么就按照普通页的方式分配内存
-  {
-    sz = PGSIZE;
-    for(a = oldsz; a < newsz; a += sz){
-      mem = kalloc();
-      if(mem == 0){
-        uvmdealloc(pagetable, a, oldsz);
-        return 0;
-      }
-#ifndef LAB_SYSCALL
-      memset(mem, 0, sz);
-#endif
-      if(mappages(pagetable, a, sz, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
-        kfree(mem);
-        uvmdealloc(pagetable, a, oldsz);
-        return 0;
-      }
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+      kfree(mem);
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
     }
+#endif
   }
-
   return newsz;
-
 }
 
-
-
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if there
+// is no memory to split a superpage that newsz falls inside.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -384,7 +821,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) != 0)
+      return oldsz;
   }
 
   return newsz;
@@ -416,64 +854,407 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  int h = PTSTATHASH(pagetable);
+  struct ptstat **pp, *st;
+
   if(sz > 0)
     uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  acquire(&ptstats[h].lock);
+  for(pp = &ptstats[h].head; (st = *pp) != 0; pp = &st->next){
+    if(st->pagetable == pagetable){
+      *pp = st->next;
+      kmfree(st);
+      break;
+    }
+  }
+  release(&ptstats[h].lock);
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Map the pages of old in [va, va+len) into new at the same
+// addresses, sharing their physical memory. If cow is set,
+// writable pages, including superpages, become copy-on-write
+// in both page tables and cowfault() copies them on the first
+// store; otherwise both go on writing the same pages, as a
+// MAP_SHARED area should. Pages not present yet are skipped;
+// paged-out ones are read back in first.
 // returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// unmaps whatever it mapped in new on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int cow)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
-  int szinc;
+  uint64 szinc;
 
-  for(i = 0; i < sz; i += szinc){
+  for(i = va; i < va + len; i += szinc){
     szinc = PGSIZE;
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
+    if((*pte & PTE_SWAP) && swapin(old, i) < 0)
+      goto err;
     if((*pte & PTE_V) == 0)
-    {
-      panic("uvmcopy: page not present");
-    }
+      continue;   // not allocated yet; the child will fault it in.
+    if(*pte & PTE_SUPER)
+      szinc = SUPERPGSIZE;
+
+    // neither side may write a shared page in place any more.
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte); //  0-9位是权限位
+    if(mappages(new, i, szinc, pa, flags) != 0)
+      goto err;
+    krefinc((void*)pa);
+  }
+  if(cow)
+    uvmflush(old, va, len);
+  return 0;
 
-    // 如果是超级页
-    if((*pte & PTE_SUPER) != 0){
-      szinc = SUPERPGSIZE;  // 如果是超级页，步进大小设为2MB
-      mem = superalloc();
-      memmove(mem, (char*)pa, SUPERPGSIZE);  // 复制2MB的内容
-      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, flags) != 0){
-        superfree(mem);
-        goto err;
-      }
-    } 
-    else // 普通页
-    {
-      mem = kalloc();
-      if(mem == 0)
-        goto err;
+ err:
+  if(cow)
+    uvmflush(old, va, len);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
+  return -1;
+}
+
+// Given a parent process's page table, share
+// its memory with a child's page table, copy-on-write.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Handle a store to the copy-on-write page (or superpage) that
+// maps va, by giving this page table a private, writable copy.
+// If nobody else shares the page any more, just make it
+// writable again.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// user page or there is no memory for the copy.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa, flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  ksmbreak(pa);
+  if(krefcnt((void*)pa) == 1 && kclaimksm((void*)pa)){
+    *pte = PA2PTE(pa) | flags;
+    uvmflush(pagetable, va, PGSIZE);
+    return 0;
+  }
+
+  if(*pte & PTE_SUPER){
+    if(pa == (uint64)zerosuper)
+      mem = superalloc_zeroed();
+    else if((mem = superalloc()) != 0)
+      memmove(mem, (char*)pa, SUPERPGSIZE);
+    if(mem == 0){
+      // no free 2MB block: split the mapping and
+      // copy just the 4KB page that was written.
+      if(uvmdemote(pagetable, va) != 0)
+        return -1;
+      pte = walk(pagetable, va, 0);
+      return (*pte & PTE_COW) ? cowfault(pagetable, va) : 0;
+    }
+    *pte = PA2PTE(mem) | flags;
+    uvmflush(pagetable, va - va % SUPERPGSIZE, SUPERPGSIZE);
+    superfree((void*)pa);
+  } else {
+    if(pa == (uint64)zeropage)
+      mem = kalloc_zeroed();
+    else if((mem = kalloc()) != 0)
       memmove(mem, (char*)pa, PGSIZE);
-      if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-        kfree(mem);
-        goto err;
-      }
+    if(mem == 0)
+      return -1;
+    *pte = PA2PTE(mem) | flags;
+    uvmflush(pagetable, va, PGSIZE);
+    kfree((void*)pa);
+  }
+  return 0;
+}
+
+// Handle a page fault at user address va in pagetable.
+// A paged-out page is read back from swap.
+// A store to a copy-on-write page gets a private copy.
+// An untouched page of a memory area, such as program text or
+// an mmap()ed file, is read in from the area's file.
+// Any other untouched address below p->sz is heap that sbrk()
+// reserved but did not allocate; give it a zeroed page, or a
+// whole superpage if its 2MB region lies entirely in the heap.
+// A load from untouched heap or bss maps the shared zero page
+// (or superpage) instead, so memory that is only read costs
+// nothing until it is written.
+// access is the permission the faulting access needs: PTE_R
+// for a load, PTE_W for a store, PTE_X for an instruction fetch.
+// Returns the physical address of the page now mapping va,
+// or 0 if the fault can't be resolved.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int access)
+{
+  struct proc *p = myproc();
+  int write = access == PTE_W;
+  struct vma *v;
+  pte_t *pte;
+  uint64 a;
+  char *mem;
+
+  if(va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_SWAP) && swapin(pagetable, va) < 0)
+    return 0;
+  if(pte && (*pte & PTE_V)){
+    if((*pte & PTE_U) && (*pte & access)){
+      // the mapping is fine; the TLB held a stale entry from
+      // before it was made, or the hardware wants the accessed
+      // and dirty bits set by software.
+      *pte |= PTE_A | (write ? PTE_D : 0);
+      uvmflush(pagetable, va, PGSIZE);
+      return walkaddr(pagetable, va);
+    }
+    if(write && cowfault(pagetable, va) == 0){
+      if(p && pagetable == p->pagetable)
+        heappromote(p, va);
+      return walkaddr(pagetable, va);
+    }
+    return 0;
+  }
+
+  if(p == 0 || pagetable != p->pagetable)
+    return 0;
+
+  if((v = vmalookup(p, va)) != 0){
+    if((v->perm & access) == 0)
+      return 0;
+    if(!write && v->type == VMA_EXEC && va - v->start >= v->filesz){
+      // a page of bss.
+      if(mapzero(pagetable, va, PGSIZE, v->perm) != 0)
+        return 0;
+      return (uint64)zeropage;
+    }
+    if((pte = walk(pagetable, va, 1)) == 0)
+      return 0;
+    if((mem = (char*)vmapage(v, va)) == 0)
+      return 0;
+    *pte = PA2PTE(mem) | v->perm | PTE_V;
+    ptstat(pagetable, ST_RESIDENT, 1);
+    return (uint64)mem;
+  }
+
+  // the heap isn't executable.
+  if(va >= p->sz || access == PTE_X)
+    return 0;
+
+  // a heap region that is wholly inside sz gets a fresh
+  // superpage if nothing in it has been touched yet.
+  a = va - va % SUPERPGSIZE;
+  if(a + SUPERPGSIZE <= p->sz && !vmaoverlap(p, a, a + SUPERPGSIZE) &&
+     (pte = walklevel(pagetable, a, 1, 1)) != 0){
+    if((*pte & PTE_V) == 0 && !write){
+      if(mapzero(pagetable, a, SUPERPGSIZE, PTE_R|PTE_W|PTE_U) != 0)
+        return 0;
+      return (uint64)zerosuper + (va - a);
+    }
+    if((*pte & PTE_V) == 0 && (mem = supercompact()) != 0){
+      *pte = PA2PTE(mem) | PTE_SUPER | PTE_R | PTE_W | PTE_U | PTE_V;
+      ptstat(pagetable, ST_RESIDENT, SUPERPGSIZE/PGSIZE);
+      ptstat(pagetable, ST_SUPER, 1);
+      return (uint64)mem + (va - a);
     }
   }
+
+  if((pte = walk(pagetable, va, 1)) == 0 || (*pte & PTE_V))
+    return 0;
+  if(!write){
+    if(mapzero(pagetable, va, PGSIZE, PTE_R|PTE_W|PTE_U) != 0)
+      return 0;
+    return (uint64)zeropage;
+  }
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  ptstat(pagetable, ST_RESIDENT, 1);
+  if(heappromote(p, va) == 0)
+    return walkaddr(pagetable, va);
+  return (uint64)mem;
+}
+
+// If the heap page at va in p was the last of its 2MB region to
+// be filled in, promote the region to a superpage. This is how a
+// heap grown a little at a time by malloc() ends up backed by
+// superpages. Returns 0 if it was promoted, -1 if not.
+static int
+heappromote(struct proc *p, uint64 va)
+{
+  uint64 a = va - va % SUPERPGSIZE;
+
+  if(va >= p->sz || a + SUPERPGSIZE > p->sz || vmaoverlap(p, a, a + SUPERPGSIZE))
+    return -1;
+  return uvmpromote(p->pagetable, a);
+}
+
+// Replace the base pages mapping the 2MB-aligned region at va
+// with a single superpage leaf. All 512 pages must be present,
+// private (one reference) and have the same permissions, so a
+// region still using the zero page anywhere stays as it is. If
+// the pages are already physically contiguous they are simply
+// remapped, otherwise they are copied into a fresh superpage.
+// Returns 0 if the region was promoted, -1 if not.
+int
+uvmpromote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *l1, *pte;
+  pagetable_t l0;
+  uint64 pa, pa0 = 0, flags = 0, ad = 0;
+  int i, contig = 1;
+  char *mem;
+
+  va -= va % SUPERPGSIZE;
+  if(va + SUPERPGSIZE > MAXVA)
+    return -1;
+  l1 = walklevel(pagetable, va, 1, 0);
+  if(l1 == 0 || (*l1 & PTE_V) == 0 || PTE_LEAF(*l1))
+    return -1;
+  l0 = (pagetable_t)PTE2PA(*l1);
+
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    pte = &l0[i];
+    // a page without PTE_U, such as exec's stack guard, must
+    // stay out of reach of user code.
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (*pte & PTE_COW))
+      return -1;
+    if(i == 0){
+      flags = PTE_FLAGS(*pte) & ~(PTE_A|PTE_D);
+      pa0 = PTE2PA(*pte);
+    } else if((PTE_FLAGS(*pte) & ~(PTE_A|PTE_D)) != flags)
+      return -1;
+    ad |= PTE_FLAGS(*pte) & (PTE_A|PTE_D);
+    pa = PTE2PA(*pte);
+    if(krefcnt((void*)pa) != 1)
+      return -1;
+    if(pa != pa0 + (uint64)i * PGSIZE)
+      contig = 0;
+  }
+  // the superpage is accessed and dirty if any of its pages was.
+  flags |= ad;
+
+  if(contig && pa0 % SUPERPGSIZE == 0 && kpromote((void*)pa0) == 0){
+    *l1 = PA2PTE(pa0) | flags | PTE_SUPER;
+    uvmflush(pagetable, va, SUPERPGSIZE);
+  } else {
+    if((mem = superalloc()) == 0)
+      return -1;
+    for(i = 0; i < SUPERPGSIZE/PGSIZE; i++)
+      memmove(mem + i*PGSIZE, (char*)PTE2PA(l0[i]), PGSIZE);
+    *l1 = PA2PTE(mem) | flags | PTE_SUPER;
+    uvmflush(pagetable, va, SUPERPGSIZE);
+    for(i = 0; i < SUPERPGSIZE/PGSIZE; i++)
+      kfree((void*)PTE2PA(l0[i]));
+  }
+  kfree((void*)l0);
+  ptstat(pagetable, ST_PTPAGES, -1);
+  ptstat(pagetable, ST_SUPER, 1);
   return 0;
+}
 
- err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
-  return -1;
+// Fault in the user pages covering [va, va+len) now, so that a
+// later copyin() or copyout() of that range won't need to sleep.
+// For callers that copy while holding a spinlock.
+// Returns 0 on success, -1 if some page can't be made present.
+int
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(a >= MAXVA)
+      return -1;
+    pte = walk(pagetable, a, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_U) &&
+       (!write || (*pte & PTE_W)))
+      continue;
+    if(vmfault(pagetable, a, write ? PTE_W : PTE_R) == 0)
+      return -1;
+  }
+  return 0;
+}
+
+// For pgaccess() and pgdirty(): find which of the npages user
+// pages from va have been accessed (flag is PTE_A) or written
+// (PTE_D) since the last look, clearing the flag. Bit i of the
+// bitmap written to mask, in user memory, is set if page
+// va + i*PGSIZE has the flag. A superpage has one flag, which
+// stands for all of its pages in the range. PTE_D stays set on
+// MAP_SHARED pages, which munmap() must still write back.
+// Returns 0 on success, -1 on a bad range or mask.
+int
+uvmpgbits(pagetable_t pagetable, uint64 va, uint64 npages, uint64 mask, int flag)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 i, a, bits = 0, nbytes, n;
+  uint64 superva = -1;
+  int acc, superacc = 0, cleared = 0;
+  pte_t *pte;
+
+  if(va % PGSIZE != 0 || va >= MAXVA || npages > (MAXVA - va) / PGSIZE)
+    return -1;
+  nbytes = (npages + 7) / 8;
+
+  for(i = 0; i < npages; i++){
+    a = va + i*PGSIZE;
+    if(a - a % SUPERPGSIZE == superva){
+      acc = superacc;
+    } else {
+      acc = 0;
+      pte = walk(pagetable, a, 0);
+      if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (*pte & flag)){
+        acc = 1;
+        if(flag != PTE_D || (v = vmalookup(p, a)) == 0 ||
+           v->type != VMA_MMAP || (v->flags & MAP_SHARED) == 0){
+          // the MMU may set the other bit meanwhile; keep it.
+          __atomic_fetch_and(pte, ~(pte_t)flag, __ATOMIC_RELAXED);
+          cleared = 1;
+        }
+      }
+      if(pte && (*pte & PTE_SUPER)){
+        superva = a - a % SUPERPGSIZE;
+        superacc = acc;
+      }
+    }
+    if(acc)
+      bits |= 1L << (i % 64);
+    if(i % 64 == 63 || i == npages - 1){
+      n = nbytes - (i / 64) * 8;
+      if(copyout(pagetable, mask + (i / 64) * 8, (char*)&bits, n < 8 ? n : 8) < 0)
+        return -1;
+      bits = 0;
+    }
+  }
+
+  // the TLB may cache the cleared flags as set.
+  if(cleared)
+    uvmflush(pagetable, va, npages * PGSIZE);
+  return 0;
 }
 
 // mark a PTE invalid for user access.
@@ -502,12 +1283,15 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     va0 = PGROUNDDOWN(dstva);
     if (va0 >= MAXVA)
       return -1;
-    if((pte = walk(pagetable, va0, 0)) == 0) {
-      // printf("copyout: pte should exist 0x%x %d\n", dstva, len);
-      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW)){
+      // allocate a lazily allocated page, or give this
+      // page table its own copy of a shared one.
+      if(vmfault(pagetable, va0, PTE_W) == 0)
+        return -1;
+      pte = walk(pagetable, va0, 0);
     }
 
-
     // forbid copyout over read-only user text pages.
     if((*pte & PTE_W) == 0)
       return -1;
@@ -519,6 +1303,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    *pte |= PTE_D;  // for MAP_SHARED write-back
 
     len -= n;
     src += n;
@@ -538,7 +1323,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, PTE_R)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -565,7 +1350,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, PTE_R)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
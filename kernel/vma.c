@@ -0,0 +1,600 @@
+// Virtual memory areas: ranges of a process's address space
+// whose pages are filled in on demand by vmfault(), such as
+// the segments of the program that exec() loaded, files
+// mapped with mmap(), and attached shared memory objects.
+//
+// A page of a file mapped MAP_SHARED is one physical page for
+// everyone who maps it, found in the fmap table by inode and
+// offset. The table holds a reference to each page, and each
+// mapping another; a page leaves the table when its last
+// mapping goes. Until then the page is newer than the file:
+// read() copies from it and write() into it, so that they and
+// the mappings agree, and munmap() writes it back if the
+// unmapping process made it dirty.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NFMAPHASH 64
+
+struct fmpage {
+  struct fmpage *next;  // in the hash chain
+  struct inode *ip;     // mappings of it hold references
+  uint64 off;           // page-aligned offset in the file
+  uint64 pa;
+};
+
+struct {
+  struct sleeplock lock;  // protects the table; held across reading in
+  struct kcache *cache;
+  struct fmpage *hash[NFMAPHASH];
+  int n;                  // pages in the table, or being read in
+} fmap;
+
+#define FMAPHASH(ip, off) ((((uint64)(ip) >> 4) ^ ((off) / PGSIZE)) % NFMAPHASH)
+
+void
+vmainit(void)
+{
+  initsleeplock(&fmap.lock, "fmap");
+  fmap.cache = kcachecreate("fmpage", sizeof(struct fmpage), 0);
+}
+
+// Return the link to the table entry for the page of ip at off,
+// which points to 0 if there is none. Caller holds fmap.lock.
+static struct fmpage **
+fmaplookup(struct inode *ip, uint64 off)
+{
+  struct fmpage **pp;
+
+  for(pp = &fmap.hash[FMAPHASH(ip, off)]; *pp; pp = &(*pp)->next)
+    if((*pp)->ip == ip && (*pp)->off == off)
+      break;
+  return pp;
+}
+
+// Return the area of p's address space that contains va, or 0.
+struct vma *
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->type != VMA_NONE && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Does any of p's areas overlap [start, end)?
+int
+vmaoverlap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->type != VMA_NONE && start < v->end && v->start < end)
+      return 1;
+  return 0;
+}
+
+// Fill mem with the contents of the page at va in area v:
+// file data up to v->filesz, zeros after that. A mapped
+// file may also end part way through the area; the rest
+// of it reads as zeros.
+// Returns 0 on success, -1 if a program file is too short.
+static int
+vmafill(struct vma *v, uint64 va, char *mem)
+{
+  uint64 off = va - v->start;
+  uint n = 0;
+  int got;
+
+  if(off < v->filesz){
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+  if(n < PGSIZE)
+    memset(mem + n, 0, PGSIZE - n);
+  if(n == 0)
+    return 0;
+
+  // fileread() and filewrite() fault in user buffers before
+  // they lock an inode, so this never runs with one locked.
+  ilock(v->ip);
+  got = readi(v->ip, 0, (uint64)mem, v->off + off, n);
+  iunlock(v->ip);
+
+  if(got < 0 || (got < n && v->type == VMA_EXEC))
+    return -1;
+  if(got < n)
+    memset(mem + got, 0, n - got);
+  return 0;
+}
+
+// Return the page at va of the MAP_SHARED area v, with a
+// reference for the caller, reading it in if it isn't in the
+// table yet. Returns 0 on failure.
+static uint64
+fmapget(struct vma *v, uint64 va)
+{
+  uint64 off = v->off + (va - v->start);
+  struct fmpage **pp, *e;
+  char *mem = 0;
+
+  acquiresleep(&fmap.lock);
+  pp = fmaplookup(v->ip, off);
+  if((e = *pp) == 0){
+    // count the page before reading it, so that a write() that
+    // the read misses sees it has to update the page.
+    __atomic_fetch_add(&fmap.n, 1, __ATOMIC_SEQ_CST);
+    if((e = kcachealloc(fmap.cache)) == 0 || (mem = kalloc()) == 0 ||
+       vmafill(v, va, mem) < 0){
+      if(mem)
+        kfree(mem);
+      if(e)
+        kcachefree(fmap.cache, e);
+      __atomic_fetch_sub(&fmap.n, 1, __ATOMIC_SEQ_CST);
+      releasesleep(&fmap.lock);
+      return 0;
+    }
+    e->ip = v->ip;
+    e->off = off;
+    e->pa = (uint64)mem;
+    e->next = 0;
+    *pp = e;
+  }
+  krefinc((void*)e->pa);
+  releasesleep(&fmap.lock);
+  return e->pa;
+}
+
+// Drop the table's page of ip at off if no mapping holds it
+// any more. Caller holds fmap.lock.
+static void
+fmapput(struct inode *ip, uint64 off)
+{
+  struct fmpage **pp, *e;
+
+  pp = fmaplookup(ip, off);
+  if((e = *pp) == 0 || krefcnt((void*)e->pa) != 1)
+    return;
+  *pp = e->next;
+  kfree((void*)e->pa);
+  kcachefree(fmap.cache, e);
+  __atomic_fetch_sub(&fmap.n, 1, __ATOMIC_SEQ_CST);
+}
+
+// Make a read() or write() of n bytes at off in ip, to or from
+// user address addr, agree with the pages of ip that are mapped
+// MAP_SHARED. Called after readi() or writei(): a read gets the
+// mapped pages' contents, and a write is copied into them.
+// The user memory must be present already.
+void
+vmafileio(struct inode *ip, uint64 off, uint64 addr, uint64 n, int write)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  struct fmpage *e;
+  uint64 a, m, po;
+
+  if(__atomic_load_n(&fmap.n, __ATOMIC_SEQ_CST) == 0)
+    return;
+  acquiresleep(&fmap.lock);
+  for(a = off; a < off + n; a += m){
+    po = a % PGSIZE;
+    m = PGSIZE - po;
+    if(m > off + n - a)
+      m = off + n - a;
+    if((e = *fmaplookup(ip, a - po)) == 0)
+      continue;
+    if(write)
+      copyin(pagetable, (char*)e->pa + po, addr + (a - off), m);
+    else
+      copyout(pagetable, addr + (a - off), (char*)e->pa + po, m);
+  }
+  releasesleep(&fmap.lock);
+}
+
+// Return a page to map at va in area v, with a reference for
+// the caller: the object's own page for shared memory or a
+// MAP_SHARED file, else a new page filled from the file, or
+// from its MAP_SHARED page if it has one. Returns 0 on failure.
+uint64
+vmapage(struct vma *v, uint64 va)
+{
+  struct fmpage *e;
+  char *mem;
+  int r;
+
+  if(v->type == VMA_SHM)
+    return shmpage(v->shm, (va - v->start) / PGSIZE);
+  if(v->type == VMA_MMAP && (v->flags & MAP_SHARED))
+    return fmapget(v, va);
+  if((mem = kalloc()) == 0)
+    return 0;
+  if(v->type == VMA_MMAP){
+    acquiresleep(&fmap.lock);
+    if((e = *fmaplookup(v->ip, v->off + (va - v->start))) != 0){
+      memmove(mem, (char*)e->pa, PGSIZE);
+      r = 0;
+    } else
+      r = vmafill(v, va, mem);
+    releasesleep(&fmap.lock);
+  } else
+    r = vmafill(v, va, mem);
+  if(r < 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
+
+// Unmap [start, end) of area v from pagetable, freeing the
+// pages. A MAP_SHARED page leaves the table if that was its
+// last mapping.
+// Returns 0 on success, -1, with nothing unmapped, if out of
+// memory to split a superpage.
+static int
+vmaclear(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+
+  if(v->type != VMA_MMAP || (v->flags & MAP_SHARED) == 0)
+    return uvmunmap(pagetable, start, (end - start) / PGSIZE, 1);
+  acquiresleep(&fmap.lock);
+  if(uvmunmap(pagetable, start, (end - start) / PGSIZE, 1) != 0){
+    releasesleep(&fmap.lock);
+    return -1;
+  }
+  for(va = start; va < end; va += PGSIZE)
+    fmapput(v->ip, v->off + (va - v->start));
+  releasesleep(&fmap.lock);
+  return 0;
+}
+
+// Find room for n bytes of new area in p's address space: the
+// highest gap below MMAPTOP that is big enough, or [addr, addr+n)
+// if addr isn't 0. Returns the start address, or -1.
+static uint64
+vmaplace(struct proc *p, uint64 addr, uint64 n)
+{
+  struct vma *v;
+  uint64 start, end;
+
+  if(addr != 0){
+    if(addr % PGSIZE != 0 || addr < PGROUNDUP(p->sz) ||
+       addr + n < addr || addr + n > MMAPTOP || vmaoverlap(p, addr, addr + n))
+      return -1;
+    return addr;
+  }
+
+  end = MMAPTOP;
+  for(;;){
+    if(end < n)
+      return -1;
+    start = end - n;
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->type != VMA_NONE && start < v->end && v->start < end)
+        break;
+    if(v == &p->vma[NVMA])
+      break;
+    end = v->start;
+  }
+  if(start < PGROUNDUP(p->sz))
+    return -1;
+  return start;
+}
+
+// Return an unused area slot of p, or 0.
+static struct vma *
+vmaslot(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->type == VMA_NONE)
+      return v;
+  return 0;
+}
+
+// Write the page at va of the MAP_SHARED area v, whose
+// contents are at pa, back to the file. Only bytes that are
+// in the file already are written; mapping a file never
+// makes it longer.
+// Returns 0 on success, -1 if the file system failed.
+static int
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  // like filewrite(), stay within one log transaction's worth
+  // of blocks per writei().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 off = v->off + (va - v->start);
+  uint64 i, n;
+  int r;
+
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(v->ip);
+    if(off + i >= v->ip->size){
+      iunlock(v->ip);
+      end_op();
+      break;
+    }
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    if(n > v->ip->size - (off + i))
+      n = v->ip->size - (off + i);
+    r = writei(v->ip, 0, pa + i, off + i, n);
+    iunlock(v->ip);
+    end_op();
+    if(r != n)
+      return -1;
+  }
+  return 0;
+}
+
+// Write back the pages of [start, end) of area v that p has
+// made dirty, if v is MAP_SHARED.
+// Returns 0 on success, -1 if some page couldn't be written.
+static int
+vmasync(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+  int r = 0;
+
+  if(v->type != VMA_MMAP || (v->flags & MAP_SHARED) == 0)
+    return 0;
+  for(va = start; va < end; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_D) &&
+       vmawriteback(v, va, PTE2PA(*pte)) < 0)
+      r = -1;
+  }
+  return r;
+}
+
+// Map n bytes of the file f, from offset off, into p's address
+// space, for mmap(). The pages are read in as they are touched.
+// Returns the address of the mapping, or -1.
+uint64
+vmammap(struct proc *p, uint64 n, int prot, int flags, struct file *f, uint64 off)
+{
+  struct vma *nv;
+  uint64 start;
+  int perm = PTE_U;
+
+  if(p->vforkparent)
+    return -1;  // the areas are the parent's
+  if(f->type != FD_INODE || n == 0 || n > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) != MAP_SHARED &&
+     (flags & (MAP_SHARED|MAP_PRIVATE)) != MAP_PRIVATE)
+    return -1;
+  if(!f->readable || ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable))
+    return -1;
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(perm == PTE_U)
+    return -1;
+
+  n = PGROUNDUP(n);
+  if((nv = vmaslot(p)) == 0 || (start = vmaplace(p, 0, n)) == -1)
+    return -1;
+
+  nv->type = VMA_MMAP;
+  nv->start = start;
+  nv->end = start + n;
+  nv->perm = perm;
+  nv->flags = flags;
+  nv->ip = idup(f->ip);
+  nv->off = off;
+  nv->filesz = n;
+  return start;
+}
+
+// Unmap [addr, addr+n) of p's mmap()ed memory, which must lie
+// within a single area, first writing modified pages of a
+// MAP_SHARED area back to the file. If that fails, or there is
+// no memory to split a superpage, the memory stays mapped, so
+// that its changes aren't lost.
+// Returns 0 on success, -1 on error.
+int
+vmaunmap(struct proc *p, uint64 addr, uint64 n)
+{
+  struct vma *v, *nv = 0;
+  uint64 end;
+
+  if(p->vforkparent || addr % PGSIZE != 0 || n == 0 || addr + n < addr)
+    return -1;
+  end = PGROUNDUP(addr + n);
+  if((v = vmalookup(p, addr)) == 0 || v->type != VMA_MMAP || end > v->end)
+    return -1;
+  // punching a hole leaves two areas.
+  if(addr > v->start && end < v->end && (nv = vmaslot(p)) == 0)
+    return -1;
+
+  if(vmasync(p, v, addr, end) < 0 || vmaclear(p->pagetable, v, addr, end) < 0)
+    return -1;
+
+  if(addr == v->start && end == v->end){
+    begin_op();
+    vmarelease(v, 1);
+    end_op();
+  } else if(addr == v->start){
+    v->off += end - v->start;
+    v->filesz -= end - v->start;
+    v->start = end;
+  } else if(end == v->end){
+    v->filesz -= v->end - addr;
+    v->end = addr;
+  } else {
+    *nv = *v;
+    nv->off += end - v->start;
+    nv->filesz = v->end - end;
+    nv->start = end;
+    idup(nv->ip);
+    v->filesz = addr - v->start;
+    v->end = addr;
+  }
+  return 0;
+}
+
+// Attach the shared memory object with handle h to p's address
+// space at addr, or wherever there's room if addr is 0.
+// Returns the address, or -1.
+uint64
+vmashmat(struct proc *p, int h, uint64 addr)
+{
+  struct vma *v;
+  struct shm *s;
+  uint64 n, start;
+
+  if(p->vforkparent || (v = vmaslot(p)) == 0 || (s = shmget(h, &n)) == 0)
+    return -1;
+  if((start = vmaplace(p, addr, n)) == -1){
+    shmput(s);
+    return -1;
+  }
+  v->type = VMA_SHM;
+  v->start = start;
+  v->end = start + n;
+  v->perm = PTE_R | PTE_W | PTE_U;
+  v->shm = s;
+  return start;
+}
+
+// Detach area v, which holds a shared memory object, from p.
+// Returns 0 on success, -1, with v still attached, if out of
+// memory to split a superpage.
+static int
+vmashmdetach(struct proc *p, struct vma *v)
+{
+  if(uvmunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, 1) != 0)
+    return -1;
+  shmput(v->shm);
+  memset(v, 0, sizeof(*v));
+  return 0;
+}
+
+// Detach the shared memory object with handle h from p.
+// Returns 0 on success, -1 if p doesn't have it attached or
+// it can't be unmapped.
+int
+vmashmdt(struct proc *p, int h)
+{
+  struct vma *v;
+
+  if(p->vforkparent)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->type == VMA_SHM && shmis(v->shm, h))
+      return vmashmdetach(p, v);
+  }
+  return -1;
+}
+
+// Give up all of p's areas, for exit() and exec(): unmap the
+// mmap()ed ones, writing back MAP_SHARED pages, detach shared
+// memory, and release every area's file. Pages of the program's
+// own areas go when the page table is freed.
+void
+vmaexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->type == VMA_MMAP){
+      // nobody is left to tell if a write-back fails.
+      vmasync(p, v, v->start, v->end);
+      vmaclear(p->pagetable, v, v->start, v->end);
+    } else if(v->type == VMA_SHM)
+      vmashmdetach(p, v);
+  }
+  begin_op();
+  vmarelease(p->vma, NVMA);
+  end_op();
+}
+
+// Give np copies of p's areas, for fork(). The pages of
+// mmap()ed areas are shared: copy-on-write for MAP_PRIVATE,
+// really shared for MAP_SHARED and shared memory objects.
+// A vfork() child shares p's page table, and so the pages too.
+// Returns 0 on success, -1 if out of memory.
+int
+vmadup(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  int i;
+
+  for(i = 0; i < NVMA && np->pagetable != p->pagetable; i++){
+    v = &p->vma[i];
+    if((v->type == VMA_MMAP || v->type == VMA_SHM) &&
+       uvmshare(p->pagetable, np->pagetable, v->start, v->end - v->start,
+                v->type == VMA_MMAP && (v->flags & MAP_SHARED) == 0) < 0){
+      while(--i >= 0){
+        v = &p->vma[i];
+        if(v->type == VMA_MMAP || v->type == VMA_SHM)
+          vmaclear(np->pagetable, v, v->start, v->end);
+      }
+      return -1;
+    }
+  }
+
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].ip)
+      idup(np->vma[i].ip);
+    if(np->vma[i].shm)
+      shmdup(np->vma[i].shm);
+  }
+  return 0;
+}
+
+// May the page that pte maps at va in p be paged out or moved
+// to another physical page? Only if p is its sole user: not
+// copy-on-write, not otherwise shared, and not part of a
+// MAP_SHARED or shared memory area, whose pages must stay the
+// same physical page.
+int
+vmamovable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if(pte & PTE_COW)
+    return 0;
+  if(krefcnt((void*)PTE2PA(pte)) != 1)
+    return 0;
+  if((v = vmalookup(p, va)) != 0 &&
+     (v->type == VMA_SHM || (v->type == VMA_MMAP && (v->flags & MAP_SHARED))))
+    return 0;
+  return 1;
+}
+
+// Release n areas starting at v.
+// Must be called inside a file system transaction.
+void
+vmarelease(struct vma *v, int n)
+{
+  for(; n > 0; n--, v++){
+    if(v->ip)
+      iput(v->ip);
+    if(v->shm)
+      shmput(v->shm);
+    memset(v, 0, sizeof(*v));
+  }
+}
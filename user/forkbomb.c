@@ -0,0 +1,50 @@
+// Fork until fork() fails, to see how many processes the
+// kernel can hold and how quickly it makes them. The children
+// wait on a pipe, so that all of them are alive at the end.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], n, pid, t0, t1;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("forkbomb: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(n = 0; ; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  t1 = uptime();
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("forkbomb: %d processes in %d ticks, %d per tick\n",
+         n, t1 - t0, n / (t1 - t0));
+
+  // let them all go.
+  close(fds[0]);
+  close(fds[1]);
+  t0 = uptime();
+  while(n > 0 && wait(0) >= 0)
+    n--;
+  t1 = uptime();
+  if(n != 0){
+    printf("forkbomb: %d children missing\n", n);
+    exit(1);
+  }
+  printf("forkbomb: reaped them in %d ticks\n", t1 - t0);
+  exit(0);
+}
@@ -1,12 +1,11 @@
 // Test that fork fails gracefully.
-// Tiny executable so that the limit can be filling the proc table.
+// Tiny executable so that the limit can be filling memory with processes.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/sysinfo.h"
 #include "user/user.h"
 
-#define N  1000
-
 void
 print(const char *s)
 {
@@ -16,10 +15,19 @@ print(const char *s)
 void
 forktest(void)
 {
-  int n, pid;
+  struct sysinfo info;
+  int n, pid, N;
 
   print("fork test\n");
 
+  // each process takes more than a page, so there's no room
+  // for as many as there are pages.
+  if(sysinfo(&info, 0, 0) < 0){
+    print("sysinfo failed\n");
+    exit(1);
+  }
+  N = info.totalpages;
+
   for(n=0; n<N; n++){
     pid = fork();
     if(pid < 0)
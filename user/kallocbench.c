@@ -0,0 +1,82 @@
+// Measure page allocator throughput as more harts compete for it.
+// Each worker repeatedly grows its heap, writes every page of
+// it, and shrinks it again. sbrk() only reserves memory, so each
+// write is a page fault that calls kalloc(), and every round
+// trip is NPAGE kalloc() and NPAGE kfree() calls.
+// Run with CPUS=1, 2, 3, ... to see how throughput scales.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NPAGE   64     // pages per sbrk() round trip
+#define ROUNDS  400    // round trips per worker
+#define MAXWORK 8
+
+void
+worker(void)
+{
+  int i, j;
+  char *p;
+
+  for(i = 0; i < ROUNDS; i++){
+    p = sbrk(NPAGE * 4096);
+    if(p == (char*)-1){
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < NPAGE; j++)
+      p[j * 4096] = j;
+    if(sbrk(-NPAGE * 4096) == (char*)-1){
+      printf("kallocbench: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+void
+run(int nworker)
+{
+  int i, t0, t1, xstatus;
+  uint64 pages;
+
+  t0 = uptime();
+  for(i = 0; i < nworker; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("kallocbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker();
+  }
+  for(i = 0; i < nworker; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t1 = uptime();
+  if(t1 == t0)
+    t1 = t0 + 1;
+
+  pages = (uint64)nworker * ROUNDS * NPAGE;
+  printf("%d workers: %ld alloc+free pairs in %d ticks, %ld per tick\n",
+         nworker, pages, t1 - t0, pages / (t1 - t0));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, max = 4;
+
+  if(argc > 1)
+    max = atoi(argv[1]);
+  if(max < 1 || max > MAXWORK){
+    printf("usage: kallocbench [1-%d]\n", MAXWORK);
+    exit(1);
+  }
+  for(n = 1; n <= max; n++)
+    run(n);
+  exit(0);
+}
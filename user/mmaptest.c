@@ -0,0 +1,249 @@
+// Tests for mmap() and munmap() of files.
+
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define FILESZ (PGSIZE + PGSIZE/2)  // file ends mid-page
+
+char *testname = "???";
+char buf[FILESZ];
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// make a file whose byte i is 'a' + i % 23.
+void
+makefile(const char *f)
+{
+  int fd, i;
+
+  unlink(f);
+  if((fd = open(f, O_WRONLY | O_CREATE)) < 0)
+    err("open");
+  for(i = 0; i < FILESZ; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, FILESZ) != FILESZ)
+    err("write");
+  close(fd);
+}
+
+// check the first FILESZ bytes at p against the file's
+// pattern, and that the rest of the last page is zero.
+void
+checkmap(char *p)
+{
+  int i;
+
+  for(i = 0; i < FILESZ; i++)
+    if(p[i] != 'a' + i % 23)
+      err("wrong file data");
+  for(; i < 2*PGSIZE; i++)
+    if(p[i] != 0)
+      err("not zero past end of file");
+}
+
+void
+private_test(void)
+{
+  int fd;
+  char *p;
+
+  testname = "private_test";
+  makefile("mmap1");
+  if((fd = open("mmap1", O_RDONLY)) < 0)
+    err("open");
+
+  // a read-only file can still be mapped writable, privately.
+  p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  checkmap(p);
+  p[0] = 'Z';
+  if(munmap(p, 2*PGSIZE) < 0)
+    err("munmap");
+
+  if((fd = open("mmap1", O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, buf, 1) != 1 || buf[0] != 'a')
+    err("private write reached the file");
+  close(fd);
+  printf("%s: OK\n", testname);
+}
+
+void
+shared_test(void)
+{
+  int fd, i;
+  char *p;
+  struct stat st;
+
+  testname = "shared_test";
+  makefile("mmap2");
+
+  if((fd = open("mmap2", O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    err("shared writable mapping of a read-only file");
+  close(fd);
+
+  if((fd = open("mmap2", O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  checkmap(p);
+  for(i = 0; i < FILESZ; i++)
+    p[i] = 'Z';
+
+  // unmap in two pieces; each is written back as it goes.
+  if(munmap(p, PGSIZE) < 0)
+    err("munmap 1");
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    err("munmap 2");
+
+  if((fd = open("mmap2", O_RDONLY)) < 0)
+    err("open");
+  if(fstat(fd, &st) < 0 || st.size != FILESZ)
+    err("file size changed");
+  if(read(fd, buf, FILESZ) != FILESZ)
+    err("read");
+  close(fd);
+  for(i = 0; i < FILESZ; i++)
+    if(buf[i] != 'Z')
+      err("shared write not in file");
+  printf("%s: OK\n", testname);
+}
+
+void
+fork_test(void)
+{
+  int fd, pid, xstatus;
+  char *s, *q;
+
+  testname = "fork_test";
+  makefile("mmap3");
+  if((fd = open("mmap3", O_RDWR)) < 0)
+    err("open");
+  s = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(s == (char*)-1 || q == (char*)-1)
+    err("mmap");
+  close(fd);
+
+  // touch one page of each before the fork, leave the other.
+  if(s[0] != 'a' || q[0] != 'a')
+    err("wrong file data");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    checkmap(s);
+    checkmap(q);
+    s[1] = 'S';
+    q[1] = 'Q';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(s[1] != 'S')
+    err("child's MAP_SHARED store not seen");
+  if(q[1] != 'b')
+    err("child's MAP_PRIVATE store seen");
+  if(munmap(s, FILESZ) < 0 || munmap(q, FILESZ) < 0)
+    err("munmap");
+  printf("%s: OK\n", testname);
+}
+
+// two processes that mmap() the same file on their own, not
+// through fork(), must see each other's stores at once, and
+// read() and write() must agree with the mapping.
+void
+coherent_test(void)
+{
+  int fd, pid, xstatus, up[2], down[2];
+  char *p, c;
+
+  testname = "coherent_test";
+  makefile("mmap4");
+  if(pipe(up) < 0 || pipe(down) < 0)
+    err("pipe");
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if((fd = open("mmap4", O_RDWR)) < 0)
+      err("open");
+    p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == (char*)-1)
+      err("mmap");
+    close(fd);
+    p[10] = 'C';
+    write(up[1], "x", 1);
+    // stay mapped until the parent has looked.
+    read(down[0], &c, 1);
+    exit(0);
+  }
+  if((fd = open("mmap4", O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  if(p[0] != 'a')
+    err("wrong file data");
+  if(read(up[0], &c, 1) != 1)
+    err("read pipe");
+  if(p[10] != 'C')
+    err("other process's store not seen");
+  if(read(fd, buf, FILESZ) != FILESZ || buf[10] != 'C')
+    err("read() doesn't see the mapping");
+  close(fd);
+  // rewrite the first 21 bytes, with a new byte 20.
+  if((fd = open("mmap4", O_RDWR)) < 0)
+    err("open");
+  buf[20] = 'W';
+  if(write(fd, buf, 21) != 21)
+    err("write");
+  close(fd);
+  if(p[20] != 'W' || p[10] != 'C')
+    err("mapping doesn't see write()");
+  write(down[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  close(up[0]);
+  close(up[1]);
+  close(down[0]);
+  close(down[1]);
+  if(munmap(p, FILESZ) < 0)
+    err("munmap");
+
+  if((fd = open("mmap4", O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, buf, FILESZ) != FILESZ)
+    err("read");
+  close(fd);
+  if(buf[10] != 'C' || buf[20] != 'W' || buf[30] != 'a' + 30 % 23)
+    err("file contents after munmap");
+  printf("%s: OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  private_test();
+  shared_test();
+  fork_test();
+  coherent_test();
+  printf("mmaptest: all tests succeeded\n");
+  exit(0);
+}
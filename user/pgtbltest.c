@@ -9,15 +9,25 @@
 void print_pgtbl();
 void print_kpgtbl();
 void ugetpid_test();
+void vdata_test();
 void superpg_test();
+void superpromote_test();
+void superdemote_test();
+void pgaccess_test();
+void pgdirty_test();
 
 int
 main(int argc, char *argv[])
 {
   print_pgtbl();
   ugetpid_test();
+  vdata_test();
   print_kpgtbl();
   superpg_test();
+  superpromote_test();
+  superdemote_test();
+  pgaccess_test();
+  pgdirty_test();
   printf("pgtbltest: all tests succeeded\n");
   exit(0);
 }
@@ -75,6 +85,46 @@ ugetpid_test()
   printf("ugetpid_test: OK\n");
 }
 
+void
+vdata_test()
+{
+  struct timespec t0, t1;
+  int pid, ret, u0, u1, u;
+
+  printf("vdata_test starting\n");
+  testname = "vdata_test";
+
+  pid = getpid();
+  ret = fork();
+  if (ret == 0) {
+    if (ugetppid() != pid)
+      err("mismatched parent PID");
+    exit(0);
+  }
+  wait(&ret);
+  if (ret != 0)
+    exit(1);
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t0) < 0)
+    err("clock_gettime failed");
+  u0 = uptime();
+  // wait for a couple of ticks, watching them go by without
+  // system calls.
+  while ((u = uptime_fast()) < u0 + 2)
+    ;
+  u1 = uptime();
+  if (u < u0 || u > u1)
+    err("uptime_fast disagrees with uptime");
+  if (clock_gettime(CLOCK_MONOTONIC, &t1) < 0)
+    err("clock_gettime failed");
+  if (t1.tv_sec < t0.tv_sec ||
+      (t1.tv_sec == t0.tv_sec && t1.tv_nsec <= t0.tv_nsec))
+    err("clock went backwards");
+  if (t1.tv_nsec >= 1000000000)
+    err("bad tv_nsec");
+  printf("vdata_test: OK\n");
+}
+
 void
 print_kpgtbl()
 {
@@ -89,6 +139,10 @@ supercheck(uint64 s)
 {
   pte_t last_pte = 0;
 
+  // sbrk() only reserves memory; touch the region so that
+  // the kernel backs it with a superpage.
+  *(volatile int*)s;
+
   for (uint64 p = s;  p < s + 512 * PGSIZE; p += PGSIZE) {
     pte_t pte = (pte_t) pgpte((void *) p);
     if(pte == 0)
@@ -97,7 +151,8 @@ supercheck(uint64 s)
         printf("last pte 0x%lx pte 0x%lx\n", last_pte, pte);
         err("pte different");
     }
-    if((pte & PTE_V) == 0 || (pte & PTE_R) == 0 || (pte & PTE_W) == 0){
+    // after fork() the superpage is shared copy-on-write.
+    if((pte & PTE_V) == 0 || (pte & PTE_R) == 0 || (pte & (PTE_W|PTE_COW)) == 0){
       err("pte wrong");
     }
     last_pte = pte;
@@ -147,3 +202,207 @@ superpg_test()
   }
   printf("superpg_test: OK\n");  
 }
+
+// grow the heap 32KB at a time, as malloc() does, and check
+// that a 2MB-aligned run of it ends up as one superpage.
+void
+superpromote_test()
+{
+  char *base, *p;
+  uint64 s;
+  pte_t pte;
+
+  printf("superpromote_test starting\n");
+  testname = "superpromote_test";
+
+  base = sbrk(0);
+  for(p = base; p < base + 3 * SUPERPGSIZE; p += 8 * PGSIZE){
+    if(sbrk(8 * PGSIZE) == (char*)-1)
+      err("sbrk failed");
+    for(int i = 0; i < 8; i++)
+      *(uint64*)(p + i * PGSIZE) = (uint64)(p + i * PGSIZE);
+  }
+
+  s = SUPERPGROUNDUP((uint64) base);
+  pte = (pte_t) pgpte((void *) s);
+  if((pte & PTE_V) == 0 || (pte & PTE_SUPER) == 0)
+    err("not promoted");
+  for(p = (char *) s; p < (char *) s + SUPERPGSIZE; p += PGSIZE){
+    if((pte_t) pgpte(p) != pte)
+      err("pte different");
+  }
+
+  for(p = base; p < base + 3 * SUPERPGSIZE; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p)
+      err("wrong value");
+  }
+  printf("superpromote_test: OK\n");
+}
+
+// shrink the heap into the middle of a superpage, and check that
+// the pages below the break survive and the ones above are gone.
+void
+superdemote_test()
+{
+  char *end, *p, *s;
+  int pid, status;
+
+  printf("superdemote_test starting\n");
+  testname = "superdemote_test";
+
+  end = sbrk(2 * SUPERPGSIZE);
+  if(end == (char*)-1)
+    err("sbrk failed");
+  s = (char *) SUPERPGROUNDUP((uint64) end);
+  for(p = s; p < s + SUPERPGSIZE; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+  if((pgpte(s) & PTE_SUPER) == 0)
+    err("no superpage");
+
+  if(sbrk(-(sbrk(0) - (s + SUPERPGSIZE/2))) == (char*)-1)
+    err("sbrk shrink failed");
+  if(pgpte(s) & PTE_SUPER)
+    err("not demoted");
+  for(p = s; p < s + SUPERPGSIZE/2; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p)
+      err("wrong value");
+  }
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    // reading above the break must fault.
+    status = *(volatile int*)(s + SUPERPGSIZE/2);
+    exit(0);
+  }
+  wait(&status);
+  if(status == 0)
+    err("page above break still mapped");
+
+  if(sbrk(PGSIZE) == (char*)-1)
+    err("sbrk failed");
+  if(*(uint64*)(s + SUPERPGSIZE/2) != 0)
+    err("regrown page not zero");
+  printf("superdemote_test: OK\n");
+}
+
+// touch a few pages, and check that pgaccess() reports just
+// those, and nothing the second time; then the same for a
+// superpage, whose one accessed bit covers all its pages.
+void
+pgaccess_test()
+{
+  char *end, *buf, *s;
+  uint64 bits[SUPERPGSIZE/PGSIZE/64];
+  int i;
+
+  printf("pgaccess_test starting\n");
+  testname = "pgaccess_test";
+
+  end = sbrk(33 * PGSIZE);
+  if(end == (char*)-1)
+    err("sbrk failed");
+  buf = (char *) PGROUNDUP((uint64) end);
+  if(pgaccess(buf, 32, bits) < 0)
+    err("pgaccess failed");
+  buf[PGSIZE * 1] += 1;
+  buf[PGSIZE * 2] += 1;
+  buf[PGSIZE * 30] += 1;
+  bits[0] = 0;
+  if(pgaccess(buf, 32, bits) < 0)
+    err("pgaccess failed");
+  if(bits[0] != ((1L << 1) | (1L << 2) | (1L << 30)))
+    err("incorrect access bits set");
+  if(pgaccess(buf, 32, bits) < 0)
+    err("pgaccess failed");
+  if(bits[0] != 0)
+    err("access bits not cleared");
+  if(pgaccess(buf + 1, 1, bits) == 0)
+    err("pgaccess of unaligned address");
+
+  end = sbrk(2 * SUPERPGSIZE);
+  if(end == (char*)-1)
+    err("sbrk failed");
+  s = (char *) SUPERPGROUNDUP((uint64) end);
+  s[0] = 1;
+  if((pgpte(s) & PTE_SUPER) == 0)
+    err("no superpage");
+  if(pgaccess(s, SUPERPGSIZE/PGSIZE, bits) < 0)
+    err("pgaccess failed");
+  s[PGSIZE * 7] += 1;
+  if(pgaccess(s, SUPERPGSIZE/PGSIZE, bits) < 0)
+    err("pgaccess failed");
+  for(i = 0; i < SUPERPGSIZE/PGSIZE/64; i++)
+    if(bits[i] != ~0L)
+      err("superpage not accessed as a whole");
+  printf("pgaccess_test: OK\n");
+}
+
+// write a few pages, and check that pgdirty() reports just
+// those; then take a snapshot of them and restore it.
+void
+pgdirty_test()
+{
+  char *end, *buf, *s;
+  uint64 bits[SUPERPGSIZE/PGSIZE/64];
+  int fd, i;
+
+  printf("pgdirty_test starting\n");
+  testname = "pgdirty_test";
+
+  end = sbrk(17 * PGSIZE);
+  if(end == (char*)-1)
+    err("sbrk failed");
+  buf = (char *) PGROUNDUP((uint64) end);
+  for(i = 0; i < 16; i++)
+    buf[i * PGSIZE] = i;
+  if(pgdirty(buf, 16, bits) < 0)
+    err("pgdirty failed");
+  if(bits[0] != 0xffff)
+    err("written pages not dirty");
+  buf[PGSIZE * 3] = 'a';
+  buf[PGSIZE * 9] += buf[PGSIZE * 10];
+  if(pgdirty(buf, 16, bits) < 0)
+    err("pgdirty failed");
+  if(bits[0] != ((1L << 3) | (1L << 9)))
+    err("incorrect dirty bits set");
+  if(pgdirty(buf, 16, bits) < 0)
+    err("pgdirty failed");
+  if(bits[0] != 0)
+    err("dirty bits not cleared");
+
+  // only page 5 has changed, so only it goes in the snapshot.
+  buf[PGSIZE * 5 + 1] = 'x';
+  if((fd = open("pgdirty.snap", O_CREATE | O_RDWR | O_TRUNC)) < 0)
+    err("open failed");
+  if(snapshot(fd, buf, 16) != 1)
+    err("snapshot wrote the wrong pages");
+  close(fd);
+  buf[PGSIZE * 5 + 1] = 'y';
+  buf[PGSIZE * 3] = 'b';
+  if((fd = open("pgdirty.snap", O_RDONLY)) < 0)
+    err("open failed");
+  if(snaprestore(fd) != 1)
+    err("snaprestore failed");
+  close(fd);
+  unlink("pgdirty.snap");
+  if(buf[PGSIZE * 5 + 1] != 'x' || buf[PGSIZE * 3] != 'b')
+    err("snaprestore restored the wrong state");
+
+  end = sbrk(2 * SUPERPGSIZE);
+  if(end == (char*)-1)
+    err("sbrk failed");
+  s = (char *) SUPERPGROUNDUP((uint64) end);
+  s[0] = 1;
+  if((pgpte(s) & PTE_SUPER) == 0)
+    err("no superpage");
+  if(pgdirty(s, SUPERPGSIZE/PGSIZE, bits) < 0)
+    err("pgdirty failed");
+  s[PGSIZE * 100] = 1;
+  if(pgdirty(s, SUPERPGSIZE/PGSIZE, bits) < 0)
+    err("pgdirty failed");
+  for(i = 0; i < SUPERPGSIZE/PGSIZE/64; i++)
+    if(bits[i] != ~0L)
+      err("superpage not dirty as a whole");
+  printf("pgdirty_test: OK\n");
+}
@@ -51,6 +51,13 @@ struct backcmd {
 
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
+void *cmdalloc(int);
+
+// Space for the parsed command line, reused for each line. A
+// full buffer of one-letter commands fits.
+char cmdspace[100/2 * sizeof(struct execcmd) + 100/2 * sizeof(struct pipecmd)];
+int cmdused;
+
 struct cmd *parsecmd(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
@@ -146,7 +153,7 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, pid;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,7 +172,13 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
+    // the child borrows the shell's memory until it execs or
+    // exits; only the parsed command, in cmdspace, changes.
+    cmdused = 0;
+    pid = vfork();
+    if(pid == -1)
+      panic("vfork");
+    if(pid == 0)
       runcmd(parsecmd(buf));
     wait(0);
   }
@@ -193,12 +206,25 @@ fork1(void)
 //PAGEBREAK!
 // Constructors
 
+void*
+cmdalloc(int n)
+{
+  void *p;
+
+  n = (n + 7) & ~7;
+  if(cmdused + n > sizeof(cmdspace))
+    panic("line too long");
+  p = cmdspace + cmdused;
+  cmdused += n;
+  return p;
+}
+
 struct cmd*
 execcmd(void)
 {
   struct execcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = cmdalloc(sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = EXEC;
   return (struct cmd*)cmd;
@@ -209,7 +235,7 @@ redircmd(struct cmd *subcmd, char *file, char *efile, int mode, int fd)
 {
   struct redircmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = cmdalloc(sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = REDIR;
   cmd->cmd = subcmd;
@@ -225,7 +251,7 @@ pipecmd(struct cmd *left, struct cmd *right)
 {
   struct pipecmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = cmdalloc(sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = PIPE;
   cmd->left = left;
@@ -238,7 +264,7 @@ listcmd(struct cmd *left, struct cmd *right)
 {
   struct listcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = cmdalloc(sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = LIST;
   cmd->left = left;
@@ -251,7 +277,7 @@ backcmd(struct cmd *subcmd)
 {
   struct backcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = cmdalloc(sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = BACK;
   cmd->cmd = subcmd;
@@ -0,0 +1,97 @@
+// Tests for shared memory objects: shmcreate(), shmat(), shmdt().
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define SZ (4 * PGSIZE)
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("shmtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// a child inherits the attachment and sees the parent's data;
+// the parent sees the child's.
+void
+fork_test(void)
+{
+  int h, pid, xstatus, i;
+  int *p;
+
+  testname = "fork_test";
+  if((h = shmcreate(SZ)) < 0)
+    err("shmcreate");
+  if((p = shmat(h, 0)) == (int*)-1)
+    err("shmat");
+  for(i = 0; i < SZ/sizeof(int); i += 256)
+    if(p[i] != 0)
+      err("not zero");
+  p[0] = 1234;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(p[0] != 1234)
+      err("child doesn't see parent's store");
+    for(i = 0; i < SZ/sizeof(int); i++)
+      p[i] = i;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(i = 0; i < SZ/sizeof(int); i++)
+    if(p[i] != i)
+      err("parent doesn't see child's stores");
+  if(shmdt(h) < 0)
+    err("shmdt");
+  if(shmdt(h) == 0)
+    err("second shmdt");
+  // that was the last attachment, so the object is gone.
+  if(shmat(h, 0) != (void*)-1)
+    err("attached a freed object");
+  printf("%s: OK\n", testname);
+}
+
+// two attachments of one object, at a chosen address and
+// another, alias each other.
+void
+alias_test(void)
+{
+  int h;
+  char *a, *b, *want;
+
+  testname = "alias_test";
+  if((h = shmcreate(SZ)) < 0)
+    err("shmcreate");
+  want = (char *) PGROUNDUP((uint64) sbrk(0)) + 64 * PGSIZE;
+  if((a = shmat(h, want)) != want)
+    err("shmat at a chosen address");
+  if(shmat(h, want + PGSIZE) != (void*)-1)
+    err("overlapping shmat");
+  if((b = shmat(h, 0)) == (char*)-1)
+    err("second shmat");
+  a[SZ - 1] = 'x';
+  if(b[SZ - 1] != 'x')
+    err("attachments don't alias");
+  if(sbrk(128 * PGSIZE) != (char*)-1)
+    err("heap grew over an attachment");
+  if(shmdt(h) < 0 || shmdt(h) < 0)
+    err("shmdt");
+  printf("%s: OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  fork_test();
+  alias_test();
+  printf("shmtest: all tests succeeded\n");
+  exit(0);
+}
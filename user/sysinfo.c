@@ -0,0 +1,41 @@
+// Print free memory and what each process has mapped.
+
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo info;
+  struct procinfo *procs, *pi;
+  int n;
+
+  // ask how many processes there are, then leave room for
+  // some more to have appeared.
+  if(sysinfo(&info, 0, 0) < 0){
+    fprintf(2, "sysinfo failed\n");
+    exit(1);
+  }
+  n = info.nproc + 8;
+  if((procs = malloc(n * sizeof(*procs))) == 0){
+    fprintf(2, "sysinfo: out of memory\n");
+    exit(1);
+  }
+  if(sysinfo(&info, procs, n) < 0){
+    fprintf(2, "sysinfo failed\n");
+    exit(1);
+  }
+  printf("memory: %ld pages (%ld KB)\n", info.totalpages, info.totalpages * 4);
+  printf("free: %ld pages (%ld KB), %ld superpages, %ld made by compaction\n",
+         info.freepages, info.freepages * 4, info.freesupers, info.compacted);
+  printf("merged: %ld pages, %ld unmerged by writes\n", info.ksmmerged, info.ksmbroken);
+
+  if(info.nproc < n)
+    n = info.nproc;
+  printf("pid\tstate\tsz\tresident\tptpages\tsuper\tname\n");
+  for(pi = procs; pi < &procs[n]; pi++)
+    printf("%d\t%s\t%ld\t%ld\t\t%ld\t%ld\t%s\n", pi->pid, pi->state, pi->sz,
+           pi->resident, pi->ptpages, pi->superpages, pi->name);
+  exit(0);
+}
@@ -158,4 +158,96 @@ ugetpid(void)
   struct usyscall *u = (struct usyscall *)USYSCALL;
   return u->pid;
 }
+
+int
+ugetppid(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return u->ppid;
+}
+
+// Like uptime(), but read from the vdata page (see
+// kernel/memlayout.h) without a system call.
+int
+uptime_fast(void)
+{
+  volatile struct vdata *vd = (struct vdata *)UVDATA;
+  uint64 t;
+  uint seq;
+
+  if(vd->version < VDATA_VERSION)
+    return uptime();
+  do {
+    while((seq = vd->seq) & 1)
+      ;
+    __sync_synchronize();
+    t = vd->ticks;
+    __sync_synchronize();
+  } while(vd->seq != seq);
+  return t;
+}
+
+// Set *ts to the time since boot, to the resolution of the
+// hardware timer, without a system call. Only CLOCK_MONOTONIC
+// is supported. Returns 0, or -1 on error.
+int
+clock_gettime(int clock, struct timespec *ts)
+{
+  volatile struct vdata *vd = (struct vdata *)UVDATA;
+  uint64 t;
+
+  if(clock != CLOCK_MONOTONIC || vd->version < VDATA_VERSION)
+    return -1;
+  t = r_time() - vd->boottime;
+  ts->tv_sec = t / vd->timefreq;
+  ts->tv_nsec = (t % vd->timefreq) * 1000000000 / vd->timefreq;
+  return 0;
+}
 #endif
+
+// Incremental snapshots of memory, for checkpointing.
+// snapshot() writes to fd each page of the npages from base
+// that has been written since the last snapshot() of it, as
+// its address followed by its 4096 bytes. Superpages count as
+// written all over if any of them was. Returns the number of
+// pages written, or -1.
+int
+snapshot(int fd, void *base, int npages)
+{
+  uint64 bits, va;
+  int i, j, n, nout = 0;
+
+  for(i = 0; i < npages; i += 64){
+    n = npages - i < 64 ? npages - i : 64;
+    if(pgdirty((char*)base + (uint64)i*4096, n, &bits) < 0)
+      return -1;
+    for(j = 0; j < n; j++){
+      if((bits & (1L << j)) == 0)
+        continue;
+      va = (uint64)base + (uint64)(i + j)*4096;
+      if(write(fd, &va, sizeof(va)) != sizeof(va) ||
+         write(fd, (void*)va, 4096) != 4096)
+        return -1;
+      nout++;
+    }
+  }
+  return nout;
+}
+
+// Copy the pages of a snapshot() file back into memory, which
+// must already be there. Later pages in the file overwrite
+// earlier ones, so a file holding a run of snapshots restores
+// the latest. Returns the number of pages read, or -1.
+int
+snaprestore(int fd)
+{
+  uint64 va;
+  int n, nin = 0;
+
+  while((n = read(fd, &va, sizeof(va))) == sizeof(va)){
+    if(read(fd, (void*)va, 4096) != 4096)
+      return -1;
+    nin++;
+  }
+  return n == 0 ? nin : -1;
+}
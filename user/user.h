@@ -1,8 +1,8 @@
-#ifdef LAB_MMAP
 typedef unsigned long size_t;
 typedef long int off_t;
-#endif
 struct stat;
+struct sysinfo;
+struct procinfo;
 
 // system calls
 int fork(void);
@@ -26,6 +26,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void *mmap(void *, size_t, int, int, int, off_t);
+int munmap(void *, size_t);
+int shmcreate(size_t);
+void *shmat(int, void *);
+int shmdt(int);
+int spawn(const char*, char**, int*);
+int vfork(void);
+int sysinfo(struct sysinfo*, struct procinfo*, int);
+int pgaccess(void*, int, void*);
+int pgdirty(void*, int, void*);
 #ifdef LAB_NET
 int bind(uint32);
 int unbind(uint32);
@@ -34,11 +44,21 @@ int recv(uint32, uint32*, uint32*, char *, uint32);
 #endif
 #ifdef LAB_PGTBL
 int ugetpid(void);
+int ugetppid(void);
 uint64 pgpte(void*);
 void kpgtbl(void);
 #endif
 
 // ulib.c
+#ifdef LAB_PGTBL
+struct timespec {
+  uint64 tv_sec;
+  uint64 tv_nsec;
+};
+#define CLOCK_MONOTONIC 1
+int uptime_fast(void);
+int clock_gettime(int, struct timespec*);
+#endif
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
@@ -52,6 +72,8 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int snapshot(int, void*, int);
+int snaprestore(int);
 #ifdef LAB_LOCK
 int statistics(void*, int);
 #endif
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -18,6 +19,7 @@
 //
 
 #define BUFSZ  ((MAXOPBLOCKS+2)*BSIZE)
+#define NINODE 50  // the kernel's old fixed inode table size
 
 char buf[BUFSZ];
 
@@ -733,6 +735,483 @@ exectest(char *s)
 
 }
 
+// exec() reads no program text in, so a fresh program's first
+// instruction fetch is a page fault that vmfault() must fill
+// from the file rather than kill the program for.
+void
+exectexttest(char *s)
+{
+  char *echoargv[] = { "echo", 0 };
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);  // echo's newline goes nowhere
+    exec("echo", echoargv);
+    printf("%s: exec echo failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(xstatus != 0){
+    printf("%s: echo exited with %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// spawn a program with its output sent to a pipe.
+void
+spawntest(char *s)
+{
+  int fds[2], pid, xstatus, n, i;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[4];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  int map[] = { 1, fds[1], fds[0], -1, fds[1], -1, -1 };
+  pid = spawn("echo", echoargv, map);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  // ends only if the child didn't keep the write end open.
+  for(n = 0; n < sizeof(buf) && (i = read(fds[0], buf+n, sizeof(buf)-n)) > 0; n += i)
+    ;
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("no-such-program", echoargv, 0) != -1){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  int badmap[] = { 1, NOFILE-1, -1 };
+  if(spawn("echo", echoargv, badmap) != -1){
+    printf("%s: spawn with a closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// a vfork() child runs in the parent's memory until it
+// exits or execs.
+int vforkshared;
+int vforkppid;
+
+void
+vforktest(char *s)
+{
+  int fds[2], pid, xstatus, n, i;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[4];
+
+  vforkshared = 0;
+  vforkppid = getpid();
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    vforkshared = getpid();
+#ifdef LAB_PGTBL
+    // the usyscall page must show the child's ids, not the
+    // parent's, while it borrows the parent's page table.
+    if(ugetpid() != getpid() || ugetppid() != vforkppid)
+      vforkshared = -1;
+#endif
+    exit(7);
+  }
+  if(wait(&xstatus) != pid || xstatus != 7){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(vforkshared != pid){
+    printf("%s: child's write not seen, or wrong ugetpid()\n", s);
+    exit(1);
+  }
+#ifdef LAB_PGTBL
+  if(ugetpid() != vforkppid){
+    printf("%s: parent's ugetpid() not restored\n", s);
+    exit(1);
+  }
+#endif
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("echo", echoargv);
+    exit(1);
+  }
+  close(fds[1]);
+  for(n = 0; n < sizeof(buf) && (i = read(fds[0], buf+n, sizeof(buf)-n)) > 0; n += i)
+    ;
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+}
+
+// more files open at once, across processes, than the kernel
+// once had room for (100).
+void
+manyfiles(char *s)
+{
+  int ready[2], go[2], fds[2], pid, i, n, xstatus;
+  char c;
+
+  if(pipe(ready) != 0 || pipe(go) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 12; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      // fill the fd table with pipes.
+      for(n = 0; pipe(fds) == 0; n++)
+        ;
+      if(n < 4)
+        exit(1);
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < 12; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child couldn't open its files\n", s);
+      exit(1);
+    }
+  }
+  close(go[1]);
+  close(ready[0]);
+  for(i = 0; i < 12; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// sysinfo() should see the pages this process touches and
+// the processes it forks.
+#define NINFO 64
+struct procinfo sysinfoprocs[NINFO];
+
+// Return this process's resident pages, according to sysinfo().
+uint64
+sysinforesident(char *s)
+{
+  struct sysinfo info;
+  int i;
+
+  if(sysinfo(&info, sysinfoprocs, NINFO) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < info.nproc && i < NINFO; i++)
+    if(sysinfoprocs[i].pid == getpid())
+      return sysinfoprocs[i].resident;
+  printf("%s: sysinfo doesn't list this process\n", s);
+  exit(1);
+}
+
+void
+sysinfotest(char *s)
+{
+  struct sysinfo info0, info1;
+  uint64 resident0, resident1;
+  int fds[2], pid, i;
+  char *a, c;
+
+  if(sysinfo(&info0, sysinfoprocs, NINFO) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  resident0 = sysinforesident(s);
+
+  a = sbrk(64*PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 64; i++)
+    a[i*PGSIZE] = 1;
+  if(sysinfo(&info1, sysinfoprocs, NINFO) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  resident1 = sysinforesident(s);
+  if(resident1 != resident0 + 64){
+    printf("%s: resident %ld, expected %ld\n", s, resident1, resident0 + 64);
+    exit(1);
+  }
+  if(info1.freepages + 64 > info0.freepages){
+    printf("%s: free pages %ld, was %ld\n", s, info1.freepages, info0.freepages);
+    exit(1);
+  }
+  sbrk(-64*PGSIZE);
+  if(sysinforesident(s) != resident0){
+    printf("%s: pages still resident after sbrk\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  close(fds[0]);
+  if(sysinfo(&info1, 0, 0) < 0 || info1.nproc != info0.nproc + 1){
+    printf("%s: nproc %ld, expected %ld\n", s, info1.nproc, info0.nproc + 1);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(0);
+}
+
+// give several processes 4KB pages scattered through memory,
+// then take superpages until memory is short, which compaction
+// may provide by moving those pages. they must keep their
+// contents through the move.
+void
+compacttest(char *s)
+{
+  enum { NCHILD = 4, NPAGE = 400 };
+  struct sysinfo info;
+  int fds[2], i, st, ok = 1;
+  uint64 n, top, want;
+  char *a, c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      // keep the heap short of a 2MB boundary, so that these
+      // are 4KB pages rather than a superpage.
+      top = (uint64)sbrk(0);
+      if(SUPERPGROUNDUP(top) - top < NPAGE*PGSIZE)
+        sbrk(SUPERPGROUNDUP(top) - top);
+      a = sbrk(NPAGE*PGSIZE);
+      if(a == (char*)-1)
+        exit(1);
+      for(n = 0; n < NPAGE; n++)
+        *(uint64*)(a + n*PGSIZE) = (uint64)a + n*PGSIZE + i;
+      write(fds[1], "x", 1);
+      // stay runnable, so that the pages may be moved.
+      int t0 = uptime();
+      while(uptime() - t0 < 10){
+        for(n = 0; n < NPAGE; n++)
+          if(*(uint64*)(a + n*PGSIZE) != (uint64)a + n*PGSIZE + i)
+            exit(2);
+      }
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < NCHILD; i++)
+    read(fds[0], &c, 1);
+  close(fds[0]);
+
+  if(sysinfo(&info, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  top = (uint64)sbrk(0);
+  want = SUPERPGROUNDUP(top) - top + (info.freepages / 2) * PGSIZE;
+  want -= want % SUPERPGSIZE;
+  a = sbrk(want);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(n = SUPERPGROUNDUP(top) - top; n < want; n += SUPERPGSIZE)
+    a[n] = 1;
+  sbrk(-want);
+
+  for(i = 0; i < NCHILD; i++){
+    wait(&st);
+    if(st != 0)
+      ok = 0;
+  }
+  if(!ok){
+    printf("%s: a child's pages changed\n", s);
+    exit(1);
+  }
+}
+
+// several processes fill pages with the same contents, which
+// the kernel should merge while they run. writes must then
+// give each its own copy again.
+void
+ksmtest(char *s)
+{
+  enum { NCHILD = 3, NPAGE = 32 };
+  struct sysinfo info0, info1;
+  int i, st, ok = 1;
+  uint64 n, x;
+  char *a;
+
+  if(sysinfo(&info0, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      a = sbrk(NPAGE*PGSIZE);
+      if(a == (char*)-1)
+        exit(1);
+      x = 0x6b736d0000000000;
+      for(n = 0; n < NPAGE*PGSIZE; n += sizeof(uint64))
+        *(uint64*)(a + n) = x + n / PGSIZE;
+      // stay runnable for a while, so that the pages may be
+      // merged, and check they stay the same.
+      int t0 = uptime();
+      while(uptime() - t0 < 20){
+        for(n = 0; n < NPAGE*PGSIZE; n += PGSIZE)
+          if(*(uint64*)(a + n) != x + n / PGSIZE)
+            exit(2);
+      }
+      for(n = 0; n < NPAGE*PGSIZE; n += PGSIZE)
+        *(uint64*)(a + n) = i;
+      for(n = 0; n < NPAGE*PGSIZE; n += PGSIZE)
+        if(*(uint64*)(a + n) != i || *(uint64*)(a + n + 8) != x + n / PGSIZE)
+          exit(3);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&st);
+    if(st != 0)
+      ok = 0;
+  }
+  if(!ok){
+    printf("%s: a child's pages changed\n", s);
+    exit(1);
+  }
+  if(sysinfo(&info1, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(info1.ksmmerged == info0.ksmmerged || info1.ksmbroken == info0.ksmbroken){
+    printf("%s: %ld pages merged, %ld unmerged\n", s,
+           info1.ksmmerged - info0.ksmmerged, info1.ksmbroken - info0.ksmbroken);
+    exit(1);
+  }
+}
+
+// reading heap that was never written should map the shared
+// zero page, or zero superpage, and allocate nothing. the
+// first write to a page must give it memory of its own.
+void
+zeropagetest(char *s)
+{
+  enum { NPAGE = 1024 };
+  struct sysinfo info0, info1;
+  uint64 n, sum = 0;
+  char *a;
+
+  a = sbrk(NPAGE*PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(sysinfo(&info0, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < NPAGE*PGSIZE; n += PGSIZE)
+    sum += *(volatile uint64*)(a + n);
+  if(sysinfo(&info1, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(sum != 0){
+    printf("%s: untouched heap not zero\n", s);
+    exit(1);
+  }
+  // a few page-table pages at most.
+  if(info1.freepages + NPAGE/16 < info0.freepages){
+    printf("%s: reads took %ld pages\n", s, info0.freepages - info1.freepages);
+    exit(1);
+  }
+
+  for(n = 0; n < NPAGE*PGSIZE; n += 64*PGSIZE)
+    a[n + 8] = 1;
+  for(n = 0; n < NPAGE*PGSIZE; n += PGSIZE){
+    if(a[n + 8] != (n % (64*PGSIZE) == 0) || a[n] != 0){
+      printf("%s: wrong value after write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-NPAGE*PGSIZE);
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1957,13 +2436,21 @@ iref(char *s)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// the forktest binary also does this. there's no fixed limit
+// on processes, so both run out of memory.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
-  int n, pid;
+  struct sysinfo info;
+  int n, pid, N;
+
+  // each process takes more than a page, so there's no room
+  // for as many as there are pages.
+  if(sysinfo(&info, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  N = info.totalpages;
 
   for(n=0; n<N; n++){
     pid = fork();
@@ -1979,7 +2466,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2608,6 +3095,14 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {exectexttest, "exectexttest"},
+  {spawntest, "spawntest"},
+  {vforktest, "vforktest"},
+  {manyfiles, "manyfiles"},
+  {sysinfotest, "sysinfotest"},
+  {compacttest, "compacttest"},
+  {ksmtest, "ksmtest"},
+  {zeropagetest, "zeropagetest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -2753,6 +3248,36 @@ manywrites(char *s)
   exit(0);
 }
 
+// touch more memory than the machine has, so that pages must
+// go out to swap, and check that they all come back intact.
+void
+swaptest(char *s)
+{
+  struct sysinfo info;
+  uint64 i, n;
+  char *a;
+
+  if(sysinfo(&info, 0, 0) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  n = info.totalpages * PGSIZE + 4*1024*1024;
+  a = sbrk(n);
+  if(a == (char*)-1){
+    printf("%s: sbrk(%ld) failed\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE)
+    *(uint64*)(a + i) = i;
+  for(i = 0; i < n; i += PGSIZE){
+    if(*(uint64*)(a + i) != i){
+      printf("%s: page at %p has %ld, not %ld\n", s, a + i, *(uint64*)(a + i), i);
+      exit(1);
+    }
+  }
+  sbrk(-n);
+}
+
 // regression test. does write() with an invalid buffer pointer cause
 // a block to be allocated for a file that is then not freed when the
 // file is deleted? if the kernel has this bug, it will panic: balloc:
@@ -2946,6 +3471,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swaptest"},
     
   { 0, 0},
 };
@@ -36,6 +36,16 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("shmcreate");
+entry("shmat");
+entry("shmdt");
+entry("spawn");
+entry("vfork");
+entry("sysinfo");
+entry("pgaccess");
+entry("pgdirty");
 entry("bind");
 entry("unbind");
 entry("send");